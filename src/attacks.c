@@ -227,7 +227,7 @@ U64 set_occupancy(int index, int bits_in_mask, U64 attack_mask)
     for (int count = 0; count < bits_in_mask; count++)
     {
         int square = get_ls1b_index(attack_mask);
-        pop_bit(attack_mask, square);
+        pop_ls1b(attack_mask);
         if (index & (1 << count))
         {
             occupancy |= (1ULL << square);
@@ -236,6 +236,8 @@ U64 set_occupancy(int index, int bits_in_mask, U64 attack_mask)
     return occupancy;
 }
 
+// Random-trial magic search. Not run at startup any more; kept to
+// regenerate the constants in bitboard.c.
 U64 find_magic_number(int square, int relevant_bits, int bishop)
 {
     U64 occupancies_arr[4096];
@@ -280,8 +282,13 @@ U64 find_magic_number(int square, int relevant_bits, int bishop)
     return 0ULL;
 }
 
+// Fill one packed table with per-square offsets (bishops first, then
+// rooks). Each square takes exactly 2^relevant_bits entries, ~840 KB total
+// instead of the 2.5 MB of fixed-size rows.
 void init_sliders_attacks(int bishop)
 {
+    int offset = bishop ? 0 : BISHOP_TABLE_SIZE;
+
     for (int square = 0; square < 64; square++)
     {
         bishop_masks[square] = mask_bishop_attacks_occupancy(square);
@@ -290,28 +297,40 @@ void init_sliders_attacks(int bishop)
         U64 attack_mask = bishop ? bishop_masks[square] : rook_masks[square];
         int relevant_bits_count = count_bits(attack_mask);
 
-        U64 magic_number = find_magic_number(square, relevant_bits_count, bishop);
-
         if (bishop)
-            bishop_magic_numbers[square] = magic_number;
+        {
+            bishop_offsets[square] = offset;
+            bishop_shifts[square] = 64 - relevant_bits_count;
+        }
         else
-            rook_magic_numbers[square] = magic_number;
+        {
+            rook_offsets[square] = offset;
+            rook_shifts[square] = 64 - relevant_bits_count;
+        }
 
         int occupancy_indices = 1 << relevant_bits_count;
         for (int index = 0; index < occupancy_indices; index++)
         {
             U64 occupancy = set_occupancy(index, relevant_bits_count, attack_mask);
-            int magic_index = (int)((occupancy * magic_number) >> (64 - relevant_bits_count));
-
-            if (bishop)
-            {
-                bishop_attacks_table[square][magic_index] = get_bishop_attacks(square, occupancy);
-            }
-            else
-            {
-                rook_attacks_table[square][magic_index] = get_rook_attacks(square, occupancy);
-            }
+            U64 attacks = bishop ? get_bishop_attacks(square, occupancy) : get_rook_attacks(square, occupancy);
+
+#ifdef USE_PEXT
+            // set_occupancy() fills mask bits in ls1b order, which is
+            // exactly the bit order _pext_u64() produces
+            int slot = offset + (int)_pext_u64(occupancy, attack_mask);
+#else
+            U64 magic_number = bishop ? bishop_magic_numbers[square] : rook_magic_numbers[square];
+            int slot = offset + (int)((occupancy * magic_number) >> (64 - relevant_bits_count));
+#endif
+
+            // Slider attacks are never empty, so a filled slot with other
+            // attacks means a bad constant
+            if (slider_attacks_table[slot] && slider_attacks_table[slot] != attacks)
+                printf("info string Bad %s magic for square %d\n", bishop ? "bishop" : "rook", square);
+
+            slider_attacks_table[slot] = attacks;
         }
+        offset += occupancy_indices;
     }
 }
 
@@ -319,45 +338,103 @@ void init_sliders_attacks(int bishop)
 //           ATTACK LOOKUP MACROS               \\
 // ============================================ \\
 
+#ifdef USE_PEXT
+U64 get_bishop_attacks_magic(int square, U64 occupancy)
+{
+    return slider_attacks_table[bishop_offsets[square] + _pext_u64(occupancy, bishop_masks[square])];
+}
+
+U64 get_rook_attacks_magic(int square, U64 occupancy)
+{
+    return slider_attacks_table[rook_offsets[square] + _pext_u64(occupancy, rook_masks[square])];
+}
+#else
 U64 get_bishop_attacks_magic(int square, U64 occupancy)
 {
-    return bishop_attacks_table[square][((occupancy & bishop_masks[square]) * bishop_magic_numbers[square]) >> (64 - count_bits(bishop_masks[square]))];
+    return slider_attacks_table[bishop_offsets[square] + (((occupancy & bishop_masks[square]) * bishop_magic_numbers[square]) >> bishop_shifts[square])];
 }
 
 U64 get_rook_attacks_magic(int square, U64 occupancy)
 {
-    return rook_attacks_table[square][((occupancy & rook_masks[square]) * rook_magic_numbers[square]) >> (64 - count_bits(rook_masks[square]))];
+    return slider_attacks_table[rook_offsets[square] + (((occupancy & rook_masks[square]) * rook_magic_numbers[square]) >> rook_shifts[square])];
+}
+#endif
+
+// ============================================ \\
+//           LINE TABLES                        \\
+// ============================================ \\
+
+// between_squares: squares strictly between two aligned squares.
+// line_through: the whole rank, file or diagonal through both.
+// Both are empty when the squares are not aligned.
+void init_line_tables()
+{
+    for (int from = 0; from < 64; from++)
+    {
+        for (int to = 0; to < 64; to++)
+        {
+            between_squares[from][to] = 0ULL;
+            line_through[from][to] = 0ULL;
+            if (from == to)
+                continue;
+
+            U64 squares = (1ULL << from) | (1ULL << to);
+            if (get_bishop_attacks(from, 0ULL) & (1ULL << to))
+            {
+                between_squares[from][to] = get_bishop_attacks(from, 1ULL << to) & get_bishop_attacks(to, 1ULL << from);
+                line_through[from][to] = (get_bishop_attacks(from, 0ULL) & get_bishop_attacks(to, 0ULL)) | squares;
+            }
+            else if (get_rook_attacks(from, 0ULL) & (1ULL << to))
+            {
+                between_squares[from][to] = get_rook_attacks(from, 1ULL << to) & get_rook_attacks(to, 1ULL << from);
+                line_through[from][to] = (get_rook_attacks(from, 0ULL) & get_rook_attacks(to, 0ULL)) | squares;
+            }
+        }
+    }
 }
 
 // ============================================ \\
 //           SQUARE ATTACK CHECK                \\
 // ============================================ \\
 
-int is_square_attacked(int square, int side_attacking)
+int is_square_attacked(const Position *pos, int square, int side_attacking)
 {
     // Pawn attacks
-    if ((side_attacking == white) && (pawn_attacks[black][square] & bitboards[P]))
+    if ((side_attacking == white) && (pawn_attacks[black][square] & pos->bitboards[P]))
         return 1;
-    if ((side_attacking == black) && (pawn_attacks[white][square] & bitboards[p]))
+    if ((side_attacking == black) && (pawn_attacks[white][square] & pos->bitboards[p]))
         return 1;
 
     // Knight attacks
-    if (knight_attacks[square] & ((side_attacking == white) ? bitboards[N] : bitboards[n]))
+    if (knight_attacks[square] & ((side_attacking == white) ? pos->bitboards[N] : pos->bitboards[n]))
         return 1;
 
     // King attacks
-    if (king_attacks[square] & ((side_attacking == white) ? bitboards[K] : bitboards[k]))
+    if (king_attacks[square] & ((side_attacking == white) ? pos->bitboards[K] : pos->bitboards[k]))
         return 1;
 
     // Diagonal attacks (Bishop + Queen)
-    U64 diagonal_attackers = (side_attacking == white) ? (bitboards[B] | bitboards[Q]) : (bitboards[b] | bitboards[q]);
-    if (get_bishop_attacks_magic(square, occupancies[both]) & diagonal_attackers)
+    U64 diagonal_attackers = (side_attacking == white) ? (pos->bitboards[B] | pos->bitboards[Q]) : (pos->bitboards[b] | pos->bitboards[q]);
+    if (get_bishop_attacks_magic(square, pos->occupancies[both]) & diagonal_attackers)
         return 1;
 
     // Straight attacks (Rook + Queen)
-    U64 straight_attackers = (side_attacking == white) ? (bitboards[R] | bitboards[Q]) : (bitboards[r] | bitboards[q]);
-    if (get_rook_attacks_magic(square, occupancies[both]) & straight_attackers)
+    U64 straight_attackers = (side_attacking == white) ? (pos->bitboards[R] | pos->bitboards[Q]) : (pos->bitboards[r] | pos->bitboards[q]);
+    if (get_rook_attacks_magic(square, pos->occupancies[both]) & straight_attackers)
         return 1;
 
     return 0;
 }
+
+// Pieces of both sides attacking 'square' with the given occupancy
+U64 attackers_to(const Position *pos, int square, U64 occupancy)
+{
+    return (pawn_attacks[black][square] & pos->bitboards[P]) |
+           (pawn_attacks[white][square] & pos->bitboards[p]) |
+           (knight_attacks[square] & (pos->bitboards[N] | pos->bitboards[n])) |
+           (king_attacks[square] & (pos->bitboards[K] | pos->bitboards[k])) |
+           (get_bishop_attacks_magic(square, occupancy) &
+            (pos->bitboards[B] | pos->bitboards[b] | pos->bitboards[Q] | pos->bitboards[q])) |
+           (get_rook_attacks_magic(square, occupancy) &
+            (pos->bitboards[R] | pos->bitboards[r] | pos->bitboards[Q] | pos->bitboards[q]));
+}
@@ -0,0 +1,313 @@
+// ============================================ \\
+//       FE64 CHESS ENGINE - BENCHMARKS         \\
+//    Micro benchmarks for low-level kernels    \\
+// ============================================ \\
+
+#include "types.h"
+
+// External function declarations
+extern long long get_time_ms();
+extern U64 get_bishop_attacks_magic(int square, U64 occupancy);
+extern U64 get_rook_attacks_magic(int square, U64 occupancy);
+extern void parse_fen(Position *pos, char *fen);
+extern long long perft_driver(Position *pos, int depth);
+extern void generate_legal_moves(const Position *pos, moves *move_list);
+extern int make_move(Position *pos, int move, int move_flag, undo_info *undo);
+extern void unmake_move(Position *pos, int move, const undo_info *undo);
+extern int init_nnue_random();
+extern int nnue_weights_loaded();
+extern int evaluate_nnue(const Position *pos);
+extern int evaluate_nnue_kernel(const Position *pos, int kernel);
+extern const char *nnue_kernel_name(int kernel);
+
+// ============================================ \\
+//              BENCH DATA                      \\
+// ============================================ \\
+
+#define BENCH_BOARDS 4096
+
+static U64 bench_boards[BENCH_BOARDS];
+static volatile U64 bench_sink;
+
+// Boards with a realistic mix of densities (~8 to ~32 bits set), from a
+// fixed xorshift seed so runs are comparable
+static void fill_bench_boards()
+{
+    U64 state = 0x9E3779B97F4A7C15ULL;
+    for (int i = 0; i < BENCH_BOARDS; i++)
+    {
+        U64 board = ~0ULL;
+        for (int j = 0; j <= i % 3; j++)
+        {
+            state ^= state << 13;
+            state ^= state >> 7;
+            state ^= state << 17;
+            board &= state;
+        }
+        bench_boards[i] = board;
+    }
+}
+
+// Report one kernel; 'ops' is the number of primitive calls made
+static void bench_report(const char *name, long long ops, long long elapsed, U64 checksum)
+{
+    if (elapsed < 1)
+        elapsed = 1;
+    printf("info string %-28s %8.1f M/s  (%lld ms, checksum %016llx)\n",
+           name, (double)ops / elapsed / 1000.0, elapsed, (unsigned long long)checksum);
+}
+
+// ============================================ \\
+//              BIT PRIMITIVES                  \\
+// ============================================ \\
+
+// The primitives as they were before the builtins, for comparison
+static int count_bits_loop(U64 bitboard)
+{
+    int count = 0;
+    while (bitboard)
+    {
+        count++;
+        bitboard &= bitboard - 1;
+    }
+    return count;
+}
+
+static int get_ls1b_index_loop(U64 bitboard)
+{
+    if (bitboard)
+        return count_bits_loop((bitboard & -bitboard) - 1);
+    return -1;
+}
+
+// Time 'expr' (which reads U64 bb) over 'rounds' passes of the boards.
+// The next board depends on the running sum so the compiler cannot
+// vectorise or hoist the loop.
+#define BENCH_POPCOUNT(name, expr)                              \
+    {                                                           \
+        U64 sum = 0;                                            \
+        long long start = get_time_ms();                        \
+        for (int round = 0; round < rounds; round++)            \
+            for (int i = 0; i < BENCH_BOARDS; i++)              \
+            {                                                   \
+                U64 bb = bench_boards[(i + sum) & (BENCH_BOARDS - 1)]; \
+                sum += (expr);                                  \
+            }                                                   \
+        bench_report(name, (long long)rounds * BENCH_BOARDS,    \
+                     get_time_ms() - start, sum);               \
+        bench_sink = sum;                                       \
+    }
+
+// Serialise every board bit by bit, the way movegen and eval loop
+#define BENCH_BITSCAN(name, scan, pop)                          \
+    {                                                           \
+        U64 sum = 0;                                            \
+        long long ops = 0;                                      \
+        long long start = get_time_ms();                        \
+        for (int round = 0; round < rounds; round++)            \
+            for (int i = 0; i < BENCH_BOARDS; i++)              \
+            {                                                   \
+                U64 bb = bench_boards[i] ^ (U64)round;          \
+                while (bb)                                      \
+                {                                               \
+                    int square = scan(bb);                      \
+                    sum += square;                              \
+                    pop;                                        \
+                    ops++;                                      \
+                }                                               \
+            }                                                   \
+        bench_report(name, ops, get_time_ms() - start, sum);    \
+        bench_sink = sum;                                       \
+    }
+
+#ifndef USE_PEXT
+// Old magic lookup with the shift recomputed from the mask every time
+static U64 rook_attacks_counted_shift(int square, U64 occupancy)
+{
+    return slider_attacks_table[rook_offsets[square] + (((occupancy & rook_masks[square]) * rook_magic_numbers[square]) >> (64 - count_bits_loop(rook_masks[square])))];
+}
+
+static U64 bishop_attacks_counted_shift(int square, U64 occupancy)
+{
+    return slider_attacks_table[bishop_offsets[square] + (((occupancy & bishop_masks[square]) * bishop_magic_numbers[square]) >> (64 - count_bits_loop(bishop_masks[square])))];
+}
+#endif
+
+#define BENCH_SLIDERS(name, rook, bishop)                                     \
+    {                                                                         \
+        U64 sum = 0;                                                          \
+        long long start = get_time_ms();                                      \
+        for (int round = 0; round < rounds; round++)                          \
+            for (int i = 0; i < BENCH_BOARDS; i++)                            \
+            {                                                                 \
+                int square = (i + round) & 63;                                \
+                sum += rook(square, bench_boards[i]) ^ bishop(square, bench_boards[i]); \
+            }                                                                 \
+        bench_report(name, 2LL * rounds * BENCH_BOARDS,                       \
+                     get_time_ms() - start, sum);                             \
+        bench_sink = sum;                                                     \
+    }
+
+// "benchbits [rounds]": compare the original loop primitives, the portable
+// fallbacks and the compiler builtins. Matching checksums confirm that all
+// versions agree.
+void bench_bits(int rounds)
+{
+    if (rounds < 1)
+        rounds = 1;
+    fill_bench_boards();
+
+    printf("info string Bit primitive benchmark: %d rounds x %d boards\n", rounds, BENCH_BOARDS);
+
+    BENCH_POPCOUNT("popcount loop (old)", count_bits_loop(bb));
+    BENCH_POPCOUNT("popcount SWAR (portable)", count_bits_portable(bb));
+    BENCH_POPCOUNT("popcount count_bits()", count_bits(bb));
+
+    BENCH_BITSCAN("bitscan loop + pop_bit (old)", get_ls1b_index_loop, pop_bit(bb, square));
+    BENCH_BITSCAN("bitscan De Bruijn (portable)", get_ls1b_index_portable, pop_ls1b(bb));
+    BENCH_BITSCAN("bitscan get_ls1b_index()", get_ls1b_index, pop_ls1b(bb));
+
+#ifndef USE_PEXT
+    BENCH_SLIDERS("magic lookup, counted shift", rook_attacks_counted_shift, bishop_attacks_counted_shift);
+    BENCH_SLIDERS("magic lookup, stored shift", get_rook_attacks_magic, get_bishop_attacks_magic);
+#endif
+}
+
+// ============================================ \\
+//              SLIDER BACKENDS                 \\
+// ============================================ \\
+
+#ifdef USE_PEXT
+#define SLIDER_BACKEND "pext"
+#else
+#define SLIDER_BACKEND "magic"
+#endif
+
+// "benchsliders [rounds]": lookups per second and perft nps for the slider
+// backend this binary was built with. "make benchsliders" runs it on both
+// the default and the "make pext" build.
+void bench_sliders(int rounds)
+{
+    static char *perft_fens[] = {
+        "rnbqkbnr/pppppppp/8/8/8/8/PPPPPPPP/RNBQKBNR w KQkq - 0 1",
+        "r3k2r/p1ppqpb1/bn2pnp1/3PN3/1p2P3/2N2Q1p/PPPBBPPP/R3K2R w KQkq - 0 1"};
+    static const int perft_depths[] = {5, 4};
+
+    if (rounds < 1)
+        rounds = 1;
+    fill_bench_boards();
+
+    printf("info string Slider backend: %s, %d rounds x %d boards\n", SLIDER_BACKEND, rounds, BENCH_BOARDS);
+
+    BENCH_SLIDERS("slider lookup (" SLIDER_BACKEND ")", get_rook_attacks_magic, get_bishop_attacks_magic);
+
+    long long nodes = 0;
+    long long start = get_time_ms();
+    for (int i = 0; i < 2; i++)
+    {
+        Position pos;
+        parse_fen(&pos, perft_fens[i]);
+        nodes += perft_driver(&pos, perft_depths[i]);
+    }
+    long long elapsed = get_time_ms() - start;
+    if (elapsed < 1)
+        elapsed = 1;
+
+    printf("info string %-28s %8.1f M/s  (%lld nodes, %lld ms)\n",
+           "perft (" SLIDER_BACKEND ")", (double)nodes / elapsed / 1000.0, nodes, elapsed);
+}
+
+// ============================================ \\
+//              NNUE KERNELS                    \\
+// ============================================ \\
+
+static char *nnue_bench_fens[] = {
+    "rnbqkbnr/pppppppp/8/8/8/8/PPPPPPPP/RNBQKBNR w KQkq - 0 1",
+    "r3k2r/p1ppqpb1/bn2pnp1/3PN3/1p2P3/2N2Q1p/PPPBBPPP/R3K2R w KQkq - 0 1",
+    "r4rk1/1pp1qppp/p1np1n2/2b1p1B1/2B1P1b1/P1NP1N2/1PP1QPPP/R4RK1 w - - 0 10",
+    "8/2p5/3p4/KP5r/1R3p1k/8/4P1P1/8 w - - 0 1",
+    "r2q1rk1/pP1p2pp/Q4n2/bbp1p3/Np6/1B3NBn/pPPP1PPP/R3K2R b KQ - 0 1",
+    "rnbq1k1r/pp1Pbppp/2p5/8/2B5/8/PPP1NnPP/RNBQK2R w KQ - 1 8",
+    "8/k7/3p4/p2P1p2/P2P1P2/8/8/K7 w - - 0 1",
+    "8/8/4k3/8/2K5/8/3P4/8 w - - 0 1"};
+
+#define NNUE_BENCH_FENS ((int)(sizeof(nnue_bench_fens) / sizeof(nnue_bench_fens[0])))
+
+// The search path: make, incremental update, eval, unmake for the children
+// of each position, or only those reached by a king move
+static void bench_nnue_search(const char *name, int rounds, int king_moves_only)
+{
+    static Position pos;
+    U64 sum = 0;
+    long long evals = 0;
+    long long start = get_time_ms();
+    for (int i = 0; i < NNUE_BENCH_FENS; i++)
+    {
+        parse_fen(&pos, nnue_bench_fens[i]);
+        sum = sum * 31 + evaluate_nnue(&pos);
+        moves move_list[1];
+        generate_legal_moves(&pos, move_list);
+        for (int round = 0; round < rounds; round++)
+            for (int m = 0; m < move_list->count; m++)
+            {
+                int move = decode_with_position(&pos, move_list->moves[m]);
+                if (king_moves_only && get_move_piece(move) != K && get_move_piece(move) != k)
+                    continue;
+                undo_info undo;
+                make_move(&pos, move, legal_move, &undo);
+                sum = sum * 31 + evaluate_nnue(&pos);
+                unmake_move(&pos, move, &undo);
+                evals++;
+            }
+    }
+    bench_report(name, evals, get_time_ms() - start, sum);
+}
+
+// "benchnnue [rounds]": evaluations per second of every NNUE kernel set in
+// this binary, from scratch on the children of a few positions. Matching
+// checksums confirm the SIMD kernels agree with the scalar reference. The
+// last lines are the search path, all moves and king moves only.
+void bench_nnue(int rounds)
+{
+    static Position pos;
+
+    if (rounds < 1)
+        rounds = 1;
+    if (!nnue_weights_loaded())
+    {
+        init_nnue_random();
+        printf("info string No net loaded, using random weights\n");
+    }
+
+    printf("info string NNUE benchmark: %d rounds\n", rounds);
+
+    for (int kernel = 0; nnue_kernel_name(kernel); kernel++)
+    {
+        U64 sum = 0;
+        long long evals = 0;
+        long long start = get_time_ms();
+        for (int i = 0; i < NNUE_BENCH_FENS; i++)
+        {
+            parse_fen(&pos, nnue_bench_fens[i]);
+            moves move_list[1];
+            generate_legal_moves(&pos, move_list);
+            for (int m = 0; m < move_list->count; m++)
+            {
+                int move = decode_with_position(&pos, move_list->moves[m]);
+                undo_info undo;
+                make_move(&pos, move, legal_move, &undo);
+                for (int round = 0; round < rounds; round++)
+                    sum = sum * 31 + evaluate_nnue_kernel(&pos, kernel);
+                evals += rounds;
+                unmake_move(&pos, move, &undo);
+            }
+        }
+
+        char name[64];
+        snprintf(name, sizeof(name), "eval from scratch (%s)", nnue_kernel_name(kernel));
+        bench_report(name, evals, get_time_ms() - start, sum);
+    }
+
+    bench_nnue_search("eval incremental (search)", rounds, 0);
+    bench_nnue_search("eval after king moves", rounds, 1);
+}
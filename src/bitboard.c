@@ -2,6 +2,9 @@
 //       FE64 CHESS ENGINE - BITBOARD OPS       \\
 // ============================================ \\
 
+// mmap/madvise flags are hidden under strict -std=c11
+#define _DEFAULT_SOURCE
+
 #include "types.h"
 
 // ============================================ \\
@@ -14,54 +17,74 @@ U64 knight_attacks[64];
 U64 king_attacks[64];
 U64 bishop_masks[64];
 U64 rook_masks[64];
-U64 bishop_attacks_table[64][512];
-U64 rook_attacks_table[64][4096];
-U64 bishop_magic_numbers[64];
-U64 rook_magic_numbers[64];
-
-// Board State
-U64 bitboards[12];
-U64 occupancies[3];
-int side;
-int en_passant = no_sq;
-int castle;
+U64 slider_attacks_table[SLIDER_TABLE_SIZE];
+U64 between_squares[64][64];
+U64 line_through[64][64];
+int bishop_offsets[64];
+int rook_offsets[64];
+int bishop_shifts[64];
+int rook_shifts[64];
+
+// Known-good magics (from find_magic_number() with the default seed), so
+// startup no longer searches for them
+const U64 bishop_magic_numbers[64] = {
+    0x0040040822862081ULL, 0x0004011802028400ULL, 0x0014034401000410ULL, 0x0008204242840040ULL,
+    0x488404200A000040ULL, 0x0002010420000400ULL, 0x20150807042000A0ULL, 0x0022010108410402ULL,
+    0x0000080908218411ULL, 0x8228300101010200ULL, 0x0005846800810902ULL, 0x04000820A0200000ULL,
+    0x0002840504254104ULL, 0x004806091018020CULL, 0x0608508184202004ULL, 0x21000C2098280819ULL,
+    0x2020004242020200ULL, 0x4102100490040101ULL, 0x0114012208001500ULL, 0x0108000682004460ULL,
+    0x7809000490401000ULL, 0x8C02001120900808ULL, 0x4024016100821001ULL, 0x0041004024050420ULL,
+    0x084440422002C400ULL, 0x0119111094040810ULL, 0x4404480810048010ULL, 0x042011000802400CULL,
+    0x8001001009004000ULL, 0x4010108001004128ULL, 0x600202009402C204ULL, 0x0210848182021280ULL,
+    0x0012021000C01120ULL, 0x001A482A00041020ULL, 0x1002404800100930ULL, 0x0002008020420200ULL,
+    0x0020040C0002C102ULL, 0x0006080200804050ULL, 0x9A82089908440401ULL, 0x0038050046102202ULL,
+    0x0188084884400911ULL, 0x0004008249009020ULL, 0x1C02001048200401ULL, 0x6002520214041A02ULL,
+    0x2800401091000200ULL, 0x0044910051001200ULL, 0x2018080860420082ULL, 0xD003410101000A02ULL,
+    0x20088A18208C0040ULL, 0x012A010101100100ULL, 0x00004241D4100310ULL, 0x004000008C240010ULL,
+    0xD048282060410880ULL, 0xCD82401002062100ULL, 0x0288C20806240014ULL, 0x1820843102002050ULL,
+    0x008200C844100804ULL, 0x01109460A4102800ULL, 0x100020004C140400ULL, 0x0042070002840404ULL,
+    0x0000350020046404ULL, 0x2400810850030A00ULL, 0x01015060A1092212ULL, 0x0020202444802040ULL};
+
+const U64 rook_magic_numbers[64] = {
+    0x7180029224804000ULL, 0x6040100020014001ULL, 0x5900140900200040ULL, 0x8100210038045000ULL,
+    0x4080040003800800ULL, 0x010004005100481AULL, 0x008002000F002080ULL, 0xC080004021000480ULL,
+    0x00808000924001A0ULL, 0x0088802001400880ULL, 0x0411001042200101ULL, 0x0105002100281001ULL,
+    0x2201000800450010ULL, 0x0052800200040081ULL, 0x0002000142000884ULL, 0xC002000112004084ULL,
+    0x0040028000204482ULL, 0x0020420020820900ULL, 0x1002020020804411ULL, 0x0028808008001004ULL,
+    0x0418010009000411ULL, 0x540080800C000200ULL, 0x0100840058050250ULL, 0x8080460000C401A1ULL,
+    0x020080208001C000ULL, 0x00C0008080200448ULL, 0x0250002020040802ULL, 0x4E01001900245000ULL,
+    0x1000110100040800ULL, 0x2006000200884410ULL, 0x0008080400021009ULL, 0x0000800080186300ULL,
+    0x9C80004000402000ULL, 0xC008462002401001ULL, 0x1003883000802000ULL, 0x2010811004800800ULL,
+    0x1203801400801802ULL, 0x0112000502001028ULL, 0x0400420304004810ULL, 0x2001001041000282ULL,
+    0x0000400820808000ULL, 0x0800200040008080ULL, 0x1040C02001010012ULL, 0x0050010010210008ULL,
+    0x0202000890060020ULL, 0x2401008804010012ULL, 0x0102004408020005ULL, 0x1010508100420024ULL,
+    0x0002410080002900ULL, 0x1000208500401100ULL, 0x0002402002110100ULL, 0x0028100089006100ULL,
+    0x1060150028001100ULL, 0x004201B0080C0A00ULL, 0x010A801200010080ULL, 0x0200040080411200ULL,
+    0x0180201089020042ULL, 0x3200811108204202ULL, 0x11002000108B0041ULL, 0x1110300049002005ULL,
+    0x7310A80005001591ULL, 0x000100680C000201ULL, 0x200050420188110CULL, 0x014203814021040AULL};
 
 // Zobrist Hashing
 U64 piece_keys[12][64];
 U64 side_key;
 U64 castle_keys[16];
 U64 enpassant_keys[64];
-U64 hash_key;
-
-// Repetition Detection
-U64 repetition_table[MAX_GAME_MOVES];
-int repetition_index = 0;
 
 // Transposition Table
-tt_entry *transposition_table = NULL;
-U64 tt_num_entries = 0;
+tt_cluster *transposition_table = NULL;
+U64 tt_num_clusters = 0;
 int tt_generation = 0;
 
 // Search State
-int best_move;
-long long nodes;
-int pv_length[MAX_PLY];
-int pv_table[MAX_PLY][MAX_PLY];
-int killer_moves[2][64];
-int history_moves[12][64];
-int counter_moves[12][64];
-int butterfly_history[2][64][64];
-int capture_history[12][64][6];
-int last_move_made[MAX_PLY];
 int lmr_table[MAX_PLY][64];
-int static_eval_stack[MAX_PLY];
-int excluded_move[MAX_PLY];
+
+// Lazy SMP: one search context per thread, [0] is the main thread
+SearchContext search_contexts[MAX_THREADS];
 
 // Timing
 long long start_time;
 long long stop_time;
 long long time_for_move;
-int times_up = 0;
+volatile int times_up = 0;
 volatile int quit_received = 0;
 
 // Pondering
@@ -75,11 +98,13 @@ int allow_ponder = 1;
 
 // UCI Options
 int hash_size_mb = 64;
+int num_threads = 1;
 int multi_pv = 1;
 int use_nnue_eval = 0;
 int contempt = 10;
 int use_book = 1;
 int probcut_margin = 200;
+int qsearch_checks = 0;
 
 // Constants
 char *start_position = "rnbqkbnr/pppppppp/8/8/8/8/PPPPPPPP/RNBQKBNR w KQkq - 0 1";
@@ -215,7 +240,7 @@ U64 generate_magic_candidate()
 
 void init_hash_keys()
 {
-    random_state = 1804289383;
+    random_state = ZOBRIST_SEED;
     for (int p = P; p <= k; p++)
         for (int s = 0; s < 64; s++)
             piece_keys[p][s] = get_random_U64_number();
@@ -226,32 +251,32 @@ void init_hash_keys()
         enpassant_keys[i] = get_random_U64_number();
 }
 
-U64 generate_hash_key()
+U64 generate_hash_key(const Position *pos)
 {
     U64 final_key = 0ULL;
     for (int p = P; p <= k; p++)
     {
-        U64 bitboard = bitboards[p];
+        U64 bitboard = pos->bitboards[p];
         while (bitboard)
         {
             int sq = get_ls1b_index(bitboard);
             final_key ^= piece_keys[p][sq];
-            pop_bit(bitboard, sq);
+            pop_ls1b(bitboard);
         }
     }
-    if (side == black)
+    if (pos->side == black)
         final_key ^= side_key;
-    if (en_passant != no_sq)
-        final_key ^= enpassant_keys[en_passant];
-    final_key ^= castle_keys[castle];
+    if (pos->en_passant != no_sq)
+        final_key ^= enpassant_keys[pos->en_passant];
+    final_key ^= castle_keys[pos->castle];
     return final_key;
 }
 
-int is_repetition()
+int is_repetition(const Position *pos)
 {
-    for (int i = repetition_index - 2; i >= 0; i -= 2)
+    for (int i = pos->repetition_index - 2; i >= 0; i -= 2)
     {
-        if (repetition_table[i] == hash_key)
+        if (pos->repetition_table[i] == pos->hash_key)
             return 1;
     }
     return 0;
@@ -261,26 +286,187 @@ int is_repetition()
 //           TRANSPOSITION TABLE                \\
 // ============================================ \\
 
+// Backing memory of transposition_table. Mapped memory comes zeroed from
+// the OS, so a freshly (re)sized table never needs clearing.
+static void *tt_memory = NULL;
+static size_t tt_memory_size = 0;
+static int tt_memory_mapped = 0;
+
+#define TT_HUGE_PAGE (2 * 1024 * 1024)
+
+static void *alloc_tt(U64 clusters)
+{
+    size_t bytes = (size_t)(clusters * sizeof(tt_cluster));
+
+#ifdef _WIN32
+    // Page aligned and zero filled
+    tt_memory = VirtualAlloc(NULL, bytes, MEM_RESERVE | MEM_COMMIT, PAGE_READWRITE);
+    if (tt_memory)
+    {
+        tt_memory_size = bytes;
+        tt_memory_mapped = 1;
+        return tt_memory;
+    }
+#else
+    // Map one extra huge page so the table can start on a 2 MB boundary,
+    // then ask for transparent huge pages to cut TLB misses on probes
+    size_t mapped = ((bytes + TT_HUGE_PAGE - 1) & ~(size_t)(TT_HUGE_PAGE - 1)) + TT_HUGE_PAGE;
+    void *mem = mmap(NULL, mapped, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (mem != MAP_FAILED)
+    {
+        void *table = (void *)(((uintptr_t)mem + TT_HUGE_PAGE - 1) & ~(uintptr_t)(TT_HUGE_PAGE - 1));
+#ifdef MADV_HUGEPAGE
+        madvise(table, mapped - ((char *)table - (char *)mem), MADV_HUGEPAGE);
+#endif
+        tt_memory = mem;
+        tt_memory_size = mapped;
+        tt_memory_mapped = 1;
+        return table;
+    }
+#endif
+
+    // Fallback: zeroed heap memory rounded up to a cache line
+    tt_memory = calloc(bytes + 63, 1);
+    tt_memory_size = bytes + 63;
+    tt_memory_mapped = 0;
+    if (!tt_memory)
+        return NULL;
+    return (void *)(((uintptr_t)tt_memory + 63) & ~(uintptr_t)63);
+}
+
+static void free_tt()
+{
+    if (!tt_memory)
+        return;
+    if (tt_memory_mapped)
+    {
+#ifdef _WIN32
+        VirtualFree(tt_memory, 0, MEM_RELEASE);
+#else
+        munmap(tt_memory, tt_memory_size);
+#endif
+    }
+    else
+    {
+        free(tt_memory);
+    }
+    tt_memory = NULL;
+    tt_memory_size = 0;
+}
+
+// ============================================ \\
+//           PARALLEL TT CLEARING               \\
+// ============================================ \\
+
+// clear_tt() zeroes the table on background workers and returns at once;
+// isready and go call wait_tt_clear() before anything touches the table.
+// Workers clear in 2 MB chunks and stop early when the table is about to
+// be freed anyway.
+
+typedef struct
+{
+    U64 start;
+    U64 count;
+} tt_clear_slice;
+
+static pthread_t tt_clear_handles[MAX_THREADS];
+static tt_clear_slice tt_clear_slices[MAX_THREADS];
+static int tt_clear_workers = 0;
+static volatile int tt_clear_abort = 0;
+
+static void *tt_clear_worker(void *arg)
+{
+    tt_clear_slice *slice = (tt_clear_slice *)arg;
+    const U64 chunk = TT_HUGE_PAGE / sizeof(tt_cluster);
+
+    for (U64 done = 0; done < slice->count && !tt_clear_abort; done += chunk)
+    {
+        U64 count = slice->count - done < chunk ? slice->count - done : chunk;
+        memset(&transposition_table[slice->start + done], 0, count * sizeof(tt_cluster));
+    }
+    return NULL;
+}
+
+void wait_tt_clear()
+{
+    for (int i = 0; i < tt_clear_workers; i++)
+        pthread_join(tt_clear_handles[i], NULL);
+    tt_clear_workers = 0;
+}
+
+static void abort_tt_clear()
+{
+    tt_clear_abort = 1;
+    wait_tt_clear();
+    tt_clear_abort = 0;
+}
+
+// Hardware threads online, at least 1 and at most MAX_THREADS
+static int hardware_threads()
+{
+#ifdef _WIN32
+    SYSTEM_INFO info;
+    GetSystemInfo(&info);
+    long count = (long)info.dwNumberOfProcessors;
+#else
+    long count = sysconf(_SC_NPROCESSORS_ONLN);
+#endif
+    if (count < 1)
+        return 1;
+    return count > MAX_THREADS ? MAX_THREADS : (int)count;
+}
+
+void clear_tt()
+{
+    wait_tt_clear();
+    tt_generation = 0;
+    if (!transposition_table || tt_num_clusters == 0)
+        return;
+
+    // One worker per hardware thread, whatever the Threads option says (the
+    // clear runs between searches), but no slice smaller than 2 MB
+    U64 min_slice = TT_HUGE_PAGE / sizeof(tt_cluster);
+    int workers = hardware_threads();
+    if ((U64)workers > tt_num_clusters / min_slice)
+        workers = (int)(tt_num_clusters / min_slice);
+    if (workers < 1)
+        workers = 1;
+
+    U64 per_worker = tt_num_clusters / workers;
+    for (int i = 0; i < workers; i++)
+    {
+        tt_clear_slices[i].start = per_worker * i;
+        tt_clear_slices[i].count = (i == workers - 1) ? tt_num_clusters - per_worker * i : per_worker;
+        if (pthread_create(&tt_clear_handles[tt_clear_workers], NULL, tt_clear_worker, &tt_clear_slices[i]) == 0)
+            tt_clear_workers++;
+        else
+            tt_clear_worker(&tt_clear_slices[i]);
+    }
+}
+
 void init_tt(int mb)
 {
-    if (transposition_table)
-        free(transposition_table);
+    abort_tt_clear();
+    free_tt();
 
     U64 size_bytes = (U64)mb * 1024ULL * 1024ULL;
-    tt_num_entries = size_bytes / sizeof(tt_entry);
-    if (tt_num_entries < 1024)
-        tt_num_entries = 1024;
+    tt_num_clusters = size_bytes / sizeof(tt_cluster);
+    if (tt_num_clusters < 1024)
+        tt_num_clusters = 1024;
 
-    transposition_table = (tt_entry *)calloc(tt_num_entries, sizeof(tt_entry));
+    transposition_table = (tt_cluster *)alloc_tt(tt_num_clusters);
     if (!transposition_table)
     {
         // Fallback to smaller size
-        tt_num_entries = TT_DEFAULT_SIZE;
-        transposition_table = (tt_entry *)calloc(tt_num_entries, sizeof(tt_entry));
+        tt_num_clusters = (U64)TT_DEFAULT_MB * 1024ULL * 1024ULL / sizeof(tt_cluster);
+        transposition_table = (tt_cluster *)alloc_tt(tt_num_clusters);
+        if (!transposition_table)
+            tt_num_clusters = 0;
     }
     tt_generation = 0;
-    printf("info string TT: %llu entries (%d MB)\n",
-           (unsigned long long)tt_num_entries, mb);
+    printf("info string TT: %llu entries in %llu clusters (%d MB%s)\n",
+           (unsigned long long)(tt_num_clusters * TT_CLUSTER_SIZE),
+           (unsigned long long)tt_num_clusters, mb, tt_memory_mapped ? ", mapped" : "");
 }
 
 void resize_tt(int mb)
@@ -288,67 +474,107 @@ void resize_tt(int mb)
     init_tt(mb);
 }
 
-void clear_tt()
+// Field packing for tt_entry.data. Scores and evals are stored biased so
+// the fields are unsigned; depth is stored + 1 so data == 0 means empty.
+#define TT_VALUE_BIAS 65536
+#define TT_EVAL_BIAS 16384
+#define tt_data_move(data) ((move16)((data) & 0xffff))
+#define tt_data_value(data) ((int)(((data) >> 16) & 0x1ffff) - TT_VALUE_BIAS)
+#define tt_data_eval(data) ((int)(((data) >> 33) & 0x7fff) - TT_EVAL_BIAS)
+#define tt_data_depth(data) ((int)(((data) >> 48) & 0xff) - 1)
+#define tt_data_flags(data) ((int)(((data) >> 56) & 3))
+#define tt_data_generation(data) ((int)((data) >> 58))
+
+static U64 make_tt_data(move16 move, int value, int static_eval, int depth, int flags, int generation)
 {
-    if (transposition_table && tt_num_entries > 0)
-        memset(transposition_table, 0, tt_num_entries * sizeof(tt_entry));
-    tt_generation = 0;
+    if (static_eval > TT_EVAL_BIAS - 1)
+        static_eval = TT_EVAL_BIAS - 1;
+    if (static_eval < -TT_EVAL_BIAS + 1)
+        static_eval = -TT_EVAL_BIAS + 1;
+    return (U64)move |
+           ((U64)(value + TT_VALUE_BIAS) << 16) |
+           ((U64)(static_eval + TT_EVAL_BIAS) << 33) |
+           ((U64)((depth + 1) & 0xff) << 48) |
+           ((U64)((generation << 2) | flags) << 56);
 }
 
-int read_tt(int alpha, int beta, int depth, int ply)
+// Generations are 6 bits wide; the age of an entry is how many searches
+// ago it was last written
+#define tt_data_age(data) ((tt_generation - tt_data_generation(data)) & 63)
+
+// Copy out the data word for 'key'. Both halves are read once with relaxed
+// atomics and checked against each other, so a concurrent write can only
+// turn a hit into a miss, never into a mismatched result.
+static int probe_tt(U64 key, U64 *data_out)
 {
-    if (!transposition_table || tt_num_entries == 0)
-        return -INF - 1;
-    tt_entry *entry = &transposition_table[hash_key % tt_num_entries];
-    if (entry->key == hash_key)
+    if (!transposition_table || tt_num_clusters == 0)
+        return 0;
+    tt_cluster *cluster = &transposition_table[tt_index(key)];
+    for (int i = 0; i < TT_CLUSTER_SIZE; i++)
     {
-        if (entry->depth >= depth)
+        tt_entry *entry = &cluster->entry[i];
+        U64 data = atomic_load_explicit(&entry->data, memory_order_relaxed);
+        U64 stored = atomic_load_explicit(&entry->key, memory_order_relaxed);
+        if (data && (stored ^ data) == key)
         {
-            int score = entry->value;
-            if (score > MATE - 100)
-                score -= ply;
-            if (score < -MATE + 100)
-                score += ply;
-            if (entry->flags == HASH_EXACT)
-                return score;
-            if (entry->flags == HASH_ALPHA && score <= alpha)
-                return alpha;
-            if (entry->flags == HASH_BETA && score >= beta)
-                return beta;
+            *data_out = data;
+            return 1;
         }
     }
+    return 0;
+}
+
+int read_tt(U64 key, int alpha, int beta, int depth, int ply)
+{
+    U64 data;
+    if (probe_tt(key, &data) && tt_data_depth(data) >= depth)
+    {
+        int score = tt_data_value(data);
+        if (score > MATE - 100)
+            score -= ply;
+        if (score < -MATE + 100)
+            score += ply;
+        int flags = tt_data_flags(data);
+        if (flags == HASH_EXACT)
+            return score;
+        if (flags == HASH_ALPHA && score <= alpha)
+            return alpha;
+        if (flags == HASH_BETA && score >= beta)
+            return beta;
+    }
     return -INF - 1;
 }
 
-int get_tt_move()
+int get_tt_move(const Position *pos)
 {
-    if (!transposition_table || tt_num_entries == 0)
-        return 0;
-    tt_entry *entry = &transposition_table[hash_key % tt_num_entries];
-    if (entry->key == hash_key)
-        return entry->best_move;
+    U64 data;
+    if (probe_tt(pos->hash_key, &data))
+        return decode_with_position(pos, tt_data_move(data));
     return 0;
 }
 
+// Static eval stored with the entry, or TT_NO_EVAL
+int get_tt_eval(U64 key)
+{
+    U64 data;
+    if (probe_tt(key, &data))
+        return tt_data_eval(data);
+    return TT_NO_EVAL;
+}
+
 // Get raw TT score and depth for singular extension checks
-int get_tt_score_raw(int ply, int *tt_depth_out, int *tt_flags_out)
+int get_tt_score_raw(U64 key, int ply, int *tt_depth_out, int *tt_flags_out)
 {
-    if (!transposition_table || tt_num_entries == 0)
-    {
-        *tt_depth_out = 0;
-        *tt_flags_out = 0;
-        return -INF - 1;
-    }
-    tt_entry *entry = &transposition_table[hash_key % tt_num_entries];
-    if (entry->key == hash_key)
+    U64 data;
+    if (probe_tt(key, &data))
     {
-        int score = entry->value;
+        int score = tt_data_value(data);
         if (score > MATE - 100)
             score -= ply;
         if (score < -MATE + 100)
             score += ply;
-        *tt_depth_out = entry->depth;
-        *tt_flags_out = entry->flags;
+        *tt_depth_out = tt_data_depth(data);
+        *tt_flags_out = tt_data_flags(data);
         return score;
     }
     *tt_depth_out = 0;
@@ -356,31 +582,327 @@ int get_tt_score_raw(int ply, int *tt_depth_out, int *tt_flags_out)
     return -INF - 1;
 }
 
-void write_tt(int depth, int value, int flags, int move, int ply)
+void write_tt(U64 key, int depth, int value, int flags, int move, int static_eval, int ply)
 {
-    if (!transposition_table || tt_num_entries == 0)
+    if (!transposition_table || tt_num_clusters == 0)
         return;
-    tt_entry *entry = &transposition_table[hash_key % tt_num_entries];
+    tt_cluster *cluster = &transposition_table[tt_index(key)];
+
+    // Take the slot already holding this position or an empty one;
+    // otherwise evict the entry that is shallowest after an 8-ply
+    // penalty per generation of age
+    tt_entry *entry = NULL;
+    U64 old_data = 0;
+    int same_key = 0;
+    int worst = 0;
+    for (int i = 0; i < TT_CLUSTER_SIZE; i++)
+    {
+        tt_entry *candidate = &cluster->entry[i];
+        U64 data = atomic_load_explicit(&candidate->data, memory_order_relaxed);
+        U64 stored = atomic_load_explicit(&candidate->key, memory_order_relaxed);
+        if (!data || (stored ^ data) == key)
+        {
+            entry = candidate;
+            old_data = data;
+            same_key = (data != 0);
+            break;
+        }
+        int worth = tt_data_depth(data) - 8 * tt_data_age(data);
+        if (!entry || worth < worst)
+        {
+            entry = candidate;
+            worst = worth;
+        }
+    }
 
-    // Replace if: empty, same position, deeper search, or older generation
-    int should_replace = (entry->key == 0) ||
-                         (entry->key == hash_key) ||
-                         (depth >= entry->depth) ||
-                         (flags == HASH_EXACT && entry->flags != HASH_EXACT);
+    // Keep the old move when re-storing the same position without one
+    move16 packed = pack_move(move);
+    if (!move && same_key)
+        packed = tt_data_move(old_data);
 
-    if (should_replace)
+    int score_to_store = value;
+    if (value > MATE - 100)
+        score_to_store += ply;
+    if (value < -MATE + 100)
+        score_to_store -= ply;
+
+    U64 data = make_tt_data(packed, score_to_store, static_eval, depth, flags, tt_generation);
+    atomic_store_explicit(&entry->key, key ^ data, memory_order_relaxed);
+    atomic_store_explicit(&entry->data, data, memory_order_relaxed);
+}
+
+// ============================================ \\
+//           TT PERSISTENCE                     \\
+// ============================================ \\
+
+// Fingerprint of the key set, so files written by a build with different
+// Zobrist keys are rejected even if the seed matches
+static U64 zobrist_check()
+{
+    U64 check = side_key;
+    for (int piece = P; piece <= k; piece++)
+        for (int square = 0; square < 64; square++)
+            check ^= piece_keys[piece][square];
+    for (int i = 0; i < 16; i++)
+        check ^= castle_keys[i];
+    for (int i = 0; i < 64; i++)
+        check ^= enpassant_keys[i];
+    return check;
+}
+
+int save_tt(const char *filename)
+{
+    wait_tt_clear();
+    if (!transposition_table || tt_num_clusters == 0)
+        return 0;
+
+    FILE *file = fopen(filename, "wb");
+    if (!file)
+    {
+        printf("info string Cannot open %s for writing\n", filename);
+        return 0;
+    }
+
+    char header_page[TT_FILE_HEADER_SIZE] = {0};
+    tt_file_header *header = (tt_file_header *)header_page;
+    memcpy(header->magic, TT_FILE_MAGIC, sizeof(TT_FILE_MAGIC));
+    header->version = TT_FILE_VERSION;
+    header->entry_size = sizeof(tt_entry);
+    header->cluster_size = TT_CLUSTER_SIZE;
+    header->generation = tt_generation;
+    header->num_clusters = tt_num_clusters;
+    header->zobrist_seed = ZOBRIST_SEED;
+    header->zobrist_check = zobrist_check();
+
+    int ok = fwrite(header_page, TT_FILE_HEADER_SIZE, 1, file) == 1;
+
+    // Write in 64 MB pieces to keep individual calls reasonable
+    const U64 chunk = (64ULL * 1024 * 1024) / sizeof(tt_cluster);
+    for (U64 done = 0; ok && done < tt_num_clusters; done += chunk)
+    {
+        U64 count = tt_num_clusters - done < chunk ? tt_num_clusters - done : chunk;
+        ok = fwrite(&transposition_table[done], sizeof(tt_cluster), count, file) == count;
+    }
+
+    if (fclose(file) != 0)
+        ok = 0;
+    printf("info string TT %s %s (%llu MB)\n", ok ? "saved to" : "failed to save to", filename,
+           (unsigned long long)(tt_num_clusters * sizeof(tt_cluster) >> 20));
+    return ok;
+}
+
+int load_tt(const char *filename)
+{
+    FILE *file = fopen(filename, "rb");
+    if (!file)
+    {
+        printf("info string Cannot open %s\n", filename);
+        return 0;
+    }
+
+    tt_file_header header;
+    if (fread(&header, sizeof(header), 1, file) != 1 ||
+        memcmp(header.magic, TT_FILE_MAGIC, sizeof(TT_FILE_MAGIC)) != 0 ||
+        header.version != TT_FILE_VERSION ||
+        header.entry_size != sizeof(tt_entry) ||
+        header.cluster_size != TT_CLUSTER_SIZE ||
+        header.num_clusters == 0)
+    {
+        printf("info string %s is not a compatible TT file\n", filename);
+        fclose(file);
+        return 0;
+    }
+    if (header.zobrist_seed != ZOBRIST_SEED || header.zobrist_check != zobrist_check())
+    {
+        printf("info string %s was saved with different Zobrist keys\n", filename);
+        fclose(file);
+        return 0;
+    }
+
+    size_t bytes = (size_t)(header.num_clusters * sizeof(tt_cluster));
+    abort_tt_clear();
+
+#ifdef _WIN32
+    // No private file mappings here: read the table into fresh memory
+    free_tt();
+    transposition_table = (tt_cluster *)alloc_tt(header.num_clusters);
+    int ok = transposition_table &&
+             fseek(file, TT_FILE_HEADER_SIZE, SEEK_SET) == 0 &&
+             fread(transposition_table, sizeof(tt_cluster), header.num_clusters, file) == header.num_clusters;
+    fclose(file);
+    if (!ok)
+    {
+        printf("info string Failed to read %s\n", filename);
+        init_tt(hash_size_mb);
+        return 0;
+    }
+#else
+    // Map the clusters copy-on-write: pages fault in from the file as the
+    // search touches them and writes never reach the file
+    struct stat info;
+    int fd = fileno(file);
+    if (fstat(fd, &info) != 0 || (U64)info.st_size < TT_FILE_HEADER_SIZE + (U64)bytes)
+    {
+        printf("info string %s is truncated\n", filename);
+        fclose(file);
+        return 0;
+    }
+    void *mem = mmap(NULL, bytes, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, TT_FILE_HEADER_SIZE);
+    fclose(file);
+    if (mem == MAP_FAILED)
+    {
+        printf("info string Failed to map %s\n", filename);
+        return 0;
+    }
+    free_tt();
+    tt_memory = mem;
+    tt_memory_size = bytes;
+    tt_memory_mapped = 1;
+    transposition_table = (tt_cluster *)mem;
+#endif
+
+    tt_num_clusters = header.num_clusters;
+    tt_generation = header.generation & 63;
+    hash_size_mb = (int)(bytes >> 20);
+    printf("info string TT loaded from %s (%d MB)\n", filename, hash_size_mb);
+    return 1;
+}
+
+// ============================================ \\
+//           TT CONCURRENCY STRESS TEST         \\
+// ============================================ \\
+
+// Threads hammer a small private table with a shared pool of keys. Every
+// field written is a function of the key, so any hit whose data differs
+// from the expected value for its key is a torn or mismatched entry.
+
+#define TT_STRESS_KEYS 64
+
+long long get_time_ms();
+
+typedef struct
+{
+    int id;
+    long long iterations;
+    long long hits;
+    long long errors;
+} tt_stress_worker;
+
+static U64 tt_stress_keys[TT_STRESS_KEYS];
+
+static U64 tt_stress_expected(U64 key)
+{
+    int move = encode_move((int)(key & 63), (int)((key >> 6) & 63), 0, (int)((key >> 12) & 15), 0, 0, 0, 0);
+    int value = (int)((key >> 20) % 40000) - 20000;
+    int static_eval = (int)((key >> 36) % 20000) - 10000;
+    int depth = 1 + (int)((key >> 52) % 60);
+    int flags = (int)((key >> 58) % 3);
+    return make_tt_data(pack_move(move), value, static_eval, depth, flags, tt_generation);
+}
+
+static void *tt_stress_thread(void *arg)
+{
+    tt_stress_worker *worker = (tt_stress_worker *)arg;
+    U64 state = 0x9E3779B97F4A7C15ULL * (U64)(worker->id + 1);
+
+    for (long long i = 0; i < worker->iterations; i++)
     {
-        int score_to_store = value;
-        if (value > MATE - 100)
-            score_to_store += ply;
-        if (value < -MATE + 100)
-            score_to_store -= ply;
-        entry->key = hash_key;
-        entry->depth = depth;
-        entry->flags = flags;
-        entry->value = score_to_store;
-        entry->best_move = move;
+        // xorshift64 to pick keys without sharing random_state
+        state ^= state << 13;
+        state ^= state >> 7;
+        state ^= state << 17;
+        U64 key = tt_stress_keys[state % TT_STRESS_KEYS];
+        U64 expected = tt_stress_expected(key);
+
+        if ((state >> 40) & 1)
+        {
+            write_tt(key, tt_data_depth(expected), tt_data_value(expected), tt_data_flags(expected),
+                     unpack_move(tt_data_move(expected)), tt_data_eval(expected), 0);
+        }
+        else
+        {
+            U64 data;
+            if (probe_tt(key, &data))
+            {
+                worker->hits++;
+                if (data != expected)
+                    worker->errors++;
+            }
+        }
+    }
+    return NULL;
+}
+
+// Run the stress test on a temporary 4-cluster table so writers collide
+// constantly, then restore the real table. Returns the number of errors.
+long long tt_stress_test(int threads, long long iterations)
+{
+    if (threads < 1)
+        threads = 1;
+    if (threads > MAX_THREADS)
+        threads = MAX_THREADS;
+
+    wait_tt_clear();
+    tt_cluster *saved_table = transposition_table;
+    U64 saved_clusters = tt_num_clusters;
+    void *saved_memory = tt_memory;
+    size_t saved_size = tt_memory_size;
+    int saved_mapped = tt_memory_mapped;
+
+    tt_num_clusters = 4;
+    transposition_table = (tt_cluster *)alloc_tt(tt_num_clusters);
+    if (!transposition_table)
+    {
+        transposition_table = saved_table;
+        tt_num_clusters = saved_clusters;
+        tt_memory = saved_memory;
+        tt_memory_size = saved_size;
+        tt_memory_mapped = saved_mapped;
+        printf("info string TT stress test: allocation failed\n");
+        return -1;
+    }
+
+    U64 seed = 0x2545F4914F6CDD1DULL;
+    for (int i = 0; i < TT_STRESS_KEYS; i++)
+    {
+        seed ^= seed << 13;
+        seed ^= seed >> 7;
+        seed ^= seed << 17;
+        tt_stress_keys[i] = seed;
+    }
+
+    pthread_t handles[MAX_THREADS];
+    tt_stress_worker workers[MAX_THREADS];
+    long long start = get_time_ms();
+    for (int i = 0; i < threads; i++)
+    {
+        workers[i].id = i;
+        workers[i].iterations = iterations;
+        workers[i].hits = 0;
+        workers[i].errors = 0;
+        pthread_create(&handles[i], NULL, tt_stress_thread, &workers[i]);
     }
+
+    long long hits = 0, errors = 0;
+    for (int i = 0; i < threads; i++)
+    {
+        pthread_join(handles[i], NULL);
+        hits += workers[i].hits;
+        errors += workers[i].errors;
+    }
+    long long elapsed = get_time_ms() - start;
+
+    free_tt();
+    transposition_table = saved_table;
+    tt_num_clusters = saved_clusters;
+    tt_memory = saved_memory;
+    tt_memory_size = saved_size;
+    tt_memory_mapped = saved_mapped;
+
+    printf("info string TT stress test: %d threads, %lld ops, %lld hits, %lld errors, %lld ms\n",
+           threads, (long long)threads * iterations, hits, errors, elapsed);
+    printf("info string TT stress test %s\n", errors ? "FAILED" : "passed");
+    return errors;
 }
 
 // ============================================ \\
@@ -405,7 +927,7 @@ void print_bitboard(U64 bitboard)
     printf("     Bitboard: %llu\n\n", bitboard);
 }
 
-void print_board()
+void print_board(const Position *pos)
 {
     printf("\n");
     for (int rank = 0; rank < 8; rank++)
@@ -415,26 +937,19 @@ void print_board()
             int square = rank * 8 + file;
             if (!file)
                 printf("  %d ", 8 - rank);
-            int piece = -1;
-            for (int bb_piece = P; bb_piece <= k; bb_piece++)
-            {
-                if (get_bit(bitboards[bb_piece], square))
-                {
-                    piece = bb_piece;
-                }
-            }
-            printf(" %c", (piece == -1) ? '.' : ascii_pieces[piece]);
+            int piece = pos->piece_on[square];
+            printf(" %c", (piece == no_piece) ? '.' : ascii_pieces[piece]);
         }
         printf("\n");
     }
     printf("\n     a b c d e f g h \n\n");
-    printf("     Side:     %s\n", !side ? "white" : "black");
-    printf("     EnPassant:   %s\n", (en_passant != no_sq) ? "Yes" : "no");
+    printf("     Side:     %s\n", !pos->side ? "white" : "black");
+    printf("     EnPassant:   %s\n", (pos->en_passant != no_sq) ? "Yes" : "no");
     printf("     Castling:  %c%c%c%c\n\n",
-           (castle & wk) ? 'K' : '-',
-           (castle & wq) ? 'Q' : '-',
-           (castle & bk) ? 'k' : '-',
-           (castle & bq) ? 'q' : '-');
+           (pos->castle & wk) ? 'K' : '-',
+           (pos->castle & wq) ? 'Q' : '-',
+           (pos->castle & bk) ? 'k' : '-',
+           (pos->castle & bq) ? 'q' : '-');
 }
 
 // ============================================ \\
@@ -554,8 +1069,12 @@ int read_line_nonblocking(char *output, int max_len)
     return 0;
 }
 
-void communicate()
+void communicate(SearchContext *ctx)
 {
+    // Helper threads never touch stdin or the clock
+    if (ctx->thread_id)
+        return;
+
     if (times_up)
         return;
 
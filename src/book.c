@@ -8,8 +8,8 @@
 #include <stdlib.h>
 
 // External function declarations
-extern void generate_moves(moves *move_list);
-extern int make_move(int move, int move_flag);
+extern int is_pseudo_legal(const Position *pos, int move);
+extern int is_legal(const Position *pos, int move);
 
 // Polyglot book entry structure
 typedef struct
@@ -229,7 +229,7 @@ const U64 polyglot_random64[781] = {
 //           POLYGLOT KEY GENERATION            \\
 // ============================================ \\
 
-U64 get_polyglot_key()
+U64 get_polyglot_key(const Position *pos)
 {
     U64 key = 0ULL;
 
@@ -242,36 +242,36 @@ U64 get_polyglot_key()
     // Pieces on squares
     for (int piece = P; piece <= k; piece++)
     {
-        U64 bb = bitboards[piece];
+        U64 bb = pos->bitboards[piece];
         while (bb)
         {
             int sq = get_ls1b_index(bb);
             int poly_sq = sq ^ 56; // Flip rank
             int poly_piece = poly_piece_map[piece];
             key ^= polyglot_random64[64 * poly_piece + poly_sq];
-            pop_bit(bb, sq);
+            pop_ls1b(bb);
         }
     }
 
     // Castling rights
-    if (castle & wk)
+    if (pos->castle & wk)
         key ^= polyglot_random64[768];
-    if (castle & wq)
+    if (pos->castle & wq)
         key ^= polyglot_random64[769];
-    if (castle & bk)
+    if (pos->castle & bk)
         key ^= polyglot_random64[770];
-    if (castle & bq)
+    if (pos->castle & bq)
         key ^= polyglot_random64[771];
 
     // En passant
-    if (en_passant != no_sq)
+    if (pos->en_passant != no_sq)
     {
-        int ep_file = en_passant % 8;
+        int ep_file = pos->en_passant % 8;
         key ^= polyglot_random64[772 + ep_file];
     }
 
     // Side to move
-    if (side == white)
+    if (pos->side == white)
         key ^= polyglot_random64[780];
 
     return key;
@@ -414,7 +414,7 @@ int find_book_entry(U64 key)
     return -1;
 }
 
-int polyglot_to_move(unsigned short poly_move)
+int polyglot_to_move(Position *pos, unsigned short poly_move)
 {
     int to_file = poly_move & 7;
     int to_rank = (poly_move >> 3) & 7;
@@ -425,43 +425,31 @@ int polyglot_to_move(unsigned short poly_move)
     int from_sq = (7 - from_rank) * 8 + from_file;
     int to_sq = (7 - to_rank) * 8 + to_file;
 
-    moves move_list[1];
-    generate_moves(move_list);
-
-    for (int i = 0; i < move_list->count; i++)
+    // Polyglot castles as king-takes-rook
+    int piece = pos->piece_on[from_sq];
+    if ((piece == K && from_sq == e1) || (piece == k && from_sq == e8))
     {
-        int move = move_list->moves[i];
-        if (get_move_source(move) == from_sq && get_move_target(move) == to_sq)
-        {
-            if (promo)
-            {
-                int our_promo = get_move_promoted(move);
-                int promo_type = (our_promo == N || our_promo == n) ? 1 : (our_promo == B || our_promo == b) ? 2
-                                                                      : (our_promo == R || our_promo == r)   ? 3
-                                                                      : (our_promo == Q || our_promo == q)   ? 4
-                                                                                                             : 0;
-                if (promo_type != promo)
-                    continue;
-            }
-
-            copy_board();
-            if (make_move(move, all_moves))
-            {
-                take_back();
-                return move;
-            }
-            take_back();
-        }
+        if (to_sq == from_sq + 3)
+            to_sq = from_sq + 2;
+        else if (to_sq == from_sq - 4)
+            to_sq = from_sq - 2;
     }
-    return 0;
+
+    // Polyglot promotions run knight = 1 .. queen = 4
+    int promoted = promo ? ((pos->side == white) ? P : p) + promo : 0;
+
+    int move = decode_with_position(pos, pack_move(encode_move(from_sq, to_sq, 0, promoted, 0, 0, 0, 0)));
+    if (!is_pseudo_legal(pos, move) || !is_legal(pos, move))
+        return 0;
+    return move;
 }
 
-int get_book_move()
+int get_book_move(Position *pos)
 {
     if (!use_book || !opening_book || book_entries == 0)
         return 0;
 
-    U64 key = get_polyglot_key();
+    U64 key = get_polyglot_key(pos);
     int idx = find_book_entry(key);
 
     if (idx < 0)
@@ -479,7 +467,7 @@ int get_book_move()
     // Collect moves
     while (idx < book_entries && opening_book[idx].key == key && num_candidates < 64)
     {
-        int move = polyglot_to_move(opening_book[idx].move);
+        int move = polyglot_to_move(pos, opening_book[idx].move);
         if (move)
         {
             candidate_moves[num_candidates] = move;
@@ -11,7 +11,7 @@ extern U64 get_rook_attacks_magic(int square, U64 occupancy);
 extern U64 get_queen_attacks(int square, U64 block);
 
 // NNUE evaluation (from nnue.c)
-extern int evaluate_nnue();
+extern int evaluate_nnue(const Position *pos);
 extern int nnue_weights_loaded();
 
 // ============================================ \\
@@ -92,7 +92,7 @@ int square_distance(int sq1, int sq2)
 //           SPACE CONTROL                      \\
 // ============================================ \\
 
-int calculate_space(int color)
+int calculate_space(const Position *pos, int color)
 {
     int space = 0;
     U64 our_attacks = 0ULL;
@@ -100,78 +100,78 @@ int calculate_space(int color)
 
     if (color == white)
     {
-        U64 pawns = bitboards[P];
+        U64 pawns = pos->bitboards[P];
         while (pawns)
         {
             int sq = get_ls1b_index(pawns);
             our_attacks |= pawn_attacks[white][sq];
-            pop_bit(pawns, sq);
+            pop_ls1b(pawns);
         }
-        U64 knights = bitboards[N];
+        U64 knights = pos->bitboards[N];
         while (knights)
         {
             int sq = get_ls1b_index(knights);
             our_attacks |= knight_attacks[sq];
-            pop_bit(knights, sq);
+            pop_ls1b(knights);
         }
-        U64 bishops = bitboards[B];
+        U64 bishops = pos->bitboards[B];
         while (bishops)
         {
             int sq = get_ls1b_index(bishops);
-            our_attacks |= get_bishop_attacks_magic(sq, occupancies[both]);
-            pop_bit(bishops, sq);
+            our_attacks |= get_bishop_attacks_magic(sq, pos->occupancies[both]);
+            pop_ls1b(bishops);
         }
-        U64 rooks = bitboards[R];
+        U64 rooks = pos->bitboards[R];
         while (rooks)
         {
             int sq = get_ls1b_index(rooks);
-            our_attacks |= get_rook_attacks_magic(sq, occupancies[both]);
-            pop_bit(rooks, sq);
+            our_attacks |= get_rook_attacks_magic(sq, pos->occupancies[both]);
+            pop_ls1b(rooks);
         }
-        U64 queens = bitboards[Q];
+        U64 queens = pos->bitboards[Q];
         while (queens)
         {
             int sq = get_ls1b_index(queens);
-            our_attacks |= get_queen_attacks(sq, occupancies[both]);
-            pop_bit(queens, sq);
+            our_attacks |= get_queen_attacks(sq, pos->occupancies[both]);
+            pop_ls1b(queens);
         }
     }
     else
     {
-        U64 pawns = bitboards[p];
+        U64 pawns = pos->bitboards[p];
         while (pawns)
         {
             int sq = get_ls1b_index(pawns);
             our_attacks |= pawn_attacks[black][sq];
-            pop_bit(pawns, sq);
+            pop_ls1b(pawns);
         }
-        U64 knights = bitboards[n];
+        U64 knights = pos->bitboards[n];
         while (knights)
         {
             int sq = get_ls1b_index(knights);
             our_attacks |= knight_attacks[sq];
-            pop_bit(knights, sq);
+            pop_ls1b(knights);
         }
-        U64 bishops = bitboards[b];
+        U64 bishops = pos->bitboards[b];
         while (bishops)
         {
             int sq = get_ls1b_index(bishops);
-            our_attacks |= get_bishop_attacks_magic(sq, occupancies[both]);
-            pop_bit(bishops, sq);
+            our_attacks |= get_bishop_attacks_magic(sq, pos->occupancies[both]);
+            pop_ls1b(bishops);
         }
-        U64 rooks = bitboards[r];
+        U64 rooks = pos->bitboards[r];
         while (rooks)
         {
             int sq = get_ls1b_index(rooks);
-            our_attacks |= get_rook_attacks_magic(sq, occupancies[both]);
-            pop_bit(rooks, sq);
+            our_attacks |= get_rook_attacks_magic(sq, pos->occupancies[both]);
+            pop_ls1b(rooks);
         }
-        U64 queens = bitboards[q];
+        U64 queens = pos->bitboards[q];
         while (queens)
         {
             int sq = get_ls1b_index(queens);
-            our_attacks |= get_queen_attacks(sq, occupancies[both]);
-            pop_bit(queens, sq);
+            our_attacks |= get_queen_attacks(sq, pos->occupancies[both]);
+            pop_ls1b(queens);
         }
     }
 
@@ -183,7 +183,7 @@ int calculate_space(int color)
 //           PIECE RESTRICTION                  \\
 // ============================================ \\
 
-int calculate_restriction(int color)
+int calculate_restriction(const Position *pos, int color)
 {
     int restriction = 0;
     const int avg_knight_mobility = 5;
@@ -191,44 +191,44 @@ int calculate_restriction(int color)
 
     if (color == white)
     {
-        U64 knights = bitboards[n];
+        U64 knights = pos->bitboards[n];
         while (knights)
         {
             int sq = get_ls1b_index(knights);
-            int mobility = count_bits(knight_attacks[sq] & ~occupancies[black]);
+            int mobility = count_bits(knight_attacks[sq] & ~pos->occupancies[black]);
             if (mobility < avg_knight_mobility)
                 restriction += (avg_knight_mobility - mobility) * restricted_piece_penalty;
-            pop_bit(knights, sq);
+            pop_ls1b(knights);
         }
-        U64 bishops = bitboards[b];
+        U64 bishops = pos->bitboards[b];
         while (bishops)
         {
             int sq = get_ls1b_index(bishops);
-            int mobility = count_bits(get_bishop_attacks_magic(sq, occupancies[both]) & ~occupancies[black]);
+            int mobility = count_bits(get_bishop_attacks_magic(sq, pos->occupancies[both]) & ~pos->occupancies[black]);
             if (mobility < avg_bishop_mobility)
                 restriction += (avg_bishop_mobility - mobility) * restricted_piece_penalty;
-            pop_bit(bishops, sq);
+            pop_ls1b(bishops);
         }
     }
     else
     {
-        U64 knights = bitboards[N];
+        U64 knights = pos->bitboards[N];
         while (knights)
         {
             int sq = get_ls1b_index(knights);
-            int mobility = count_bits(knight_attacks[sq] & ~occupancies[white]);
+            int mobility = count_bits(knight_attacks[sq] & ~pos->occupancies[white]);
             if (mobility < avg_knight_mobility)
                 restriction += (avg_knight_mobility - mobility) * restricted_piece_penalty;
-            pop_bit(knights, sq);
+            pop_ls1b(knights);
         }
-        U64 bishops = bitboards[B];
+        U64 bishops = pos->bitboards[B];
         while (bishops)
         {
             int sq = get_ls1b_index(bishops);
-            int mobility = count_bits(get_bishop_attacks_magic(sq, occupancies[both]) & ~occupancies[white]);
+            int mobility = count_bits(get_bishop_attacks_magic(sq, pos->occupancies[both]) & ~pos->occupancies[white]);
             if (mobility < avg_bishop_mobility)
                 restriction += (avg_bishop_mobility - mobility) * restricted_piece_penalty;
-            pop_bit(bishops, sq);
+            pop_ls1b(bishops);
         }
     }
     return restriction;
@@ -238,7 +238,7 @@ int calculate_restriction(int color)
 //           PAWN STRUCTURE                     \\
 // ============================================ \\
 
-int is_outpost(int square, int color)
+int is_outpost(const Position *pos, int square, int color)
 {
     int file = square % 8;
     int rank = square / 8;
@@ -248,12 +248,12 @@ int is_outpost(int square, int color)
     if (color == black && rank < 4)
         return 0;
 
-    U64 our_pawns = (color == white) ? bitboards[P] : bitboards[p];
+    U64 our_pawns = (color == white) ? pos->bitboards[P] : pos->bitboards[p];
     U64 pawn_defenders = (color == white) ? pawn_attacks[black][square] : pawn_attacks[white][square];
     if (!(pawn_defenders & our_pawns))
         return 0;
 
-    U64 enemy_pawns = (color == white) ? bitboards[p] : bitboards[P];
+    U64 enemy_pawns = (color == white) ? pos->bitboards[p] : pos->bitboards[P];
     for (int r = (color == white) ? rank - 1 : rank + 1;
          (color == white) ? r >= 0 : r <= 7;
          r += (color == white) ? -1 : 1)
@@ -270,10 +270,10 @@ int is_outpost(int square, int color)
     return 1;
 }
 
-int calculate_pawn_chain(int color)
+int calculate_pawn_chain(const Position *pos, int color)
 {
     int bonus = 0;
-    U64 pawns = (color == white) ? bitboards[P] : bitboards[p];
+    U64 pawns = (color == white) ? pos->bitboards[P] : pos->bitboards[p];
     U64 original_pawns = pawns;
 
     while (pawns)
@@ -282,52 +282,52 @@ int calculate_pawn_chain(int color)
         U64 defenders = (color == white) ? pawn_attacks[black][sq] : pawn_attacks[white][sq];
         if (defenders & original_pawns)
             bonus += pawn_chain_bonus;
-        pop_bit(pawns, sq);
+        pop_ls1b(pawns);
     }
     return bonus;
 }
 
-int calculate_king_tropism(int color)
+int calculate_king_tropism(const Position *pos, int color)
 {
     int tropism = 0;
-    int enemy_king = (color == white) ? get_ls1b_index(bitboards[k]) : get_ls1b_index(bitboards[K]);
+    int enemy_king = (color == white) ? get_ls1b_index(pos->bitboards[k]) : get_ls1b_index(pos->bitboards[K]);
 
-    U64 knights = (color == white) ? bitboards[N] : bitboards[n];
+    U64 knights = (color == white) ? pos->bitboards[N] : pos->bitboards[n];
     while (knights)
     {
         int sq = get_ls1b_index(knights);
         tropism += (7 - square_distance(sq, enemy_king)) * king_tropism_bonus;
-        pop_bit(knights, sq);
+        pop_ls1b(knights);
     }
 
-    U64 bishops = (color == white) ? bitboards[B] : bitboards[b];
+    U64 bishops = (color == white) ? pos->bitboards[B] : pos->bitboards[b];
     while (bishops)
     {
         int sq = get_ls1b_index(bishops);
         tropism += (7 - square_distance(sq, enemy_king)) * king_tropism_bonus;
-        pop_bit(bishops, sq);
+        pop_ls1b(bishops);
     }
 
-    U64 rooks = (color == white) ? bitboards[R] : bitboards[r];
+    U64 rooks = (color == white) ? pos->bitboards[R] : pos->bitboards[r];
     while (rooks)
     {
         int sq = get_ls1b_index(rooks);
         tropism += (7 - square_distance(sq, enemy_king)) * king_tropism_bonus / 2;
-        pop_bit(rooks, sq);
+        pop_ls1b(rooks);
     }
 
-    U64 queens = (color == white) ? bitboards[Q] : bitboards[q];
+    U64 queens = (color == white) ? pos->bitboards[Q] : pos->bitboards[q];
     while (queens)
     {
         int sq = get_ls1b_index(queens);
         tropism += (7 - square_distance(sq, enemy_king)) * king_tropism_bonus * 2;
-        pop_bit(queens, sq);
+        pop_ls1b(queens);
     }
 
     return tropism;
 }
 
-int count_king_attackers(int king_square, int attacking_side)
+int count_king_attackers(const Position *pos, int king_square, int attacking_side)
 {
     int attackers = 0;
     int attack_weight = 0;
@@ -338,7 +338,7 @@ int count_king_attackers(int king_square, int attacking_side)
     if (attacking_side == white)
     {
         // Knight attacks on king zone
-        U64 knights = bitboards[N];
+        U64 knights = pos->bitboards[N];
         while (knights)
         {
             int sq = get_ls1b_index(knights);
@@ -347,51 +347,51 @@ int count_king_attackers(int king_square, int attacking_side)
                 attackers++;
                 attack_weight += 25;
             }
-            pop_bit(knights, sq);
+            pop_ls1b(knights);
         }
 
         // Bishop attacks on king zone
-        U64 bishops = bitboards[B];
+        U64 bishops = pos->bitboards[B];
         while (bishops)
         {
             int sq = get_ls1b_index(bishops);
-            if (get_bishop_attacks_magic(sq, occupancies[both]) & king_zone)
+            if (get_bishop_attacks_magic(sq, pos->occupancies[both]) & king_zone)
             {
                 attackers++;
                 attack_weight += 25;
             }
-            pop_bit(bishops, sq);
+            pop_ls1b(bishops);
         }
 
         // Rook attacks on king zone
-        U64 rooks = bitboards[R];
+        U64 rooks = pos->bitboards[R];
         while (rooks)
         {
             int sq = get_ls1b_index(rooks);
-            if (get_rook_attacks_magic(sq, occupancies[both]) & king_zone)
+            if (get_rook_attacks_magic(sq, pos->occupancies[both]) & king_zone)
             {
                 attackers++;
                 attack_weight += 50;
             }
-            pop_bit(rooks, sq);
+            pop_ls1b(rooks);
         }
 
         // Queen attacks on king zone
-        U64 queens = bitboards[Q];
+        U64 queens = pos->bitboards[Q];
         while (queens)
         {
             int sq = get_ls1b_index(queens);
-            if (get_queen_attacks(sq, occupancies[both]) & king_zone)
+            if (get_queen_attacks(sq, pos->occupancies[both]) & king_zone)
             {
                 attackers++;
                 attack_weight += 100;
             }
-            pop_bit(queens, sq);
+            pop_ls1b(queens);
         }
     }
     else
     {
-        U64 knights = bitboards[n];
+        U64 knights = pos->bitboards[n];
         while (knights)
         {
             int sq = get_ls1b_index(knights);
@@ -400,43 +400,43 @@ int count_king_attackers(int king_square, int attacking_side)
                 attackers++;
                 attack_weight += 25;
             }
-            pop_bit(knights, sq);
+            pop_ls1b(knights);
         }
 
-        U64 bishops = bitboards[b];
+        U64 bishops = pos->bitboards[b];
         while (bishops)
         {
             int sq = get_ls1b_index(bishops);
-            if (get_bishop_attacks_magic(sq, occupancies[both]) & king_zone)
+            if (get_bishop_attacks_magic(sq, pos->occupancies[both]) & king_zone)
             {
                 attackers++;
                 attack_weight += 25;
             }
-            pop_bit(bishops, sq);
+            pop_ls1b(bishops);
         }
 
-        U64 rooks = bitboards[r];
+        U64 rooks = pos->bitboards[r];
         while (rooks)
         {
             int sq = get_ls1b_index(rooks);
-            if (get_rook_attacks_magic(sq, occupancies[both]) & king_zone)
+            if (get_rook_attacks_magic(sq, pos->occupancies[both]) & king_zone)
             {
                 attackers++;
                 attack_weight += 50;
             }
-            pop_bit(rooks, sq);
+            pop_ls1b(rooks);
         }
 
-        U64 queens = bitboards[q];
+        U64 queens = pos->bitboards[q];
         while (queens)
         {
             int sq = get_ls1b_index(queens);
-            if (get_queen_attacks(sq, occupancies[both]) & king_zone)
+            if (get_queen_attacks(sq, pos->occupancies[both]) & king_zone)
             {
                 attackers++;
                 attack_weight += 100;
             }
-            pop_bit(queens, sq);
+            pop_ls1b(queens);
         }
     }
 
@@ -447,7 +447,7 @@ int count_king_attackers(int king_square, int attacking_side)
     return attack_weight;
 }
 
-int is_passed_pawn(int square, int color)
+int is_passed_pawn(const Position *pos, int square, int color)
 {
     int file = square % 8;
     int rank = square / 8;
@@ -460,7 +460,7 @@ int is_passed_pawn(int square, int color)
             {
                 if (f >= 0 && f <= 7)
                 {
-                    if (get_bit(bitboards[p], r * 8 + f))
+                    if (get_bit(pos->bitboards[p], r * 8 + f))
                         return 0;
                 }
             }
@@ -475,7 +475,7 @@ int is_passed_pawn(int square, int color)
             {
                 if (f >= 0 && f <= 7)
                 {
-                    if (get_bit(bitboards[P], r * 8 + f))
+                    if (get_bit(pos->bitboards[P], r * 8 + f))
                         return 0;
                 }
             }
@@ -488,12 +488,12 @@ int is_passed_pawn(int square, int color)
 //       CONSTRICTOR PRESSURE EVALUATION        \\
 // ============================================ \\
 
-int has_insufficient_mating_material()
+int has_insufficient_mating_material(const Position *pos)
 {
-    int white_minors = count_bits(bitboards[N] | bitboards[B]);
-    int black_minors = count_bits(bitboards[n] | bitboards[b]);
-    int white_heavy_or_pawns = count_bits(bitboards[P] | bitboards[R] | bitboards[Q]);
-    int black_heavy_or_pawns = count_bits(bitboards[p] | bitboards[r] | bitboards[q]);
+    int white_minors = count_bits(pos->bitboards[N] | pos->bitboards[B]);
+    int black_minors = count_bits(pos->bitboards[n] | pos->bitboards[b]);
+    int white_heavy_or_pawns = count_bits(pos->bitboards[P] | pos->bitboards[R] | pos->bitboards[Q]);
+    int black_heavy_or_pawns = count_bits(pos->bitboards[p] | pos->bitboards[r] | pos->bitboards[q]);
 
     if (white_heavy_or_pawns || black_heavy_or_pawns)
         return 0;
@@ -504,68 +504,68 @@ int has_insufficient_mating_material()
     return white_minors <= 1 && black_minors <= 1;
 }
 
-static U64 attacks_by_color(int color)
+static U64 attacks_by_color(const Position *pos, int color)
 {
     U64 attacks = 0ULL;
     U64 pieces;
 
-    pieces = (color == white) ? bitboards[P] : bitboards[p];
+    pieces = (color == white) ? pos->bitboards[P] : pos->bitboards[p];
     while (pieces)
     {
         int sq = get_ls1b_index(pieces);
         attacks |= pawn_attacks[color][sq];
-        pop_bit(pieces, sq);
+        pop_ls1b(pieces);
     }
 
-    pieces = (color == white) ? bitboards[N] : bitboards[n];
+    pieces = (color == white) ? pos->bitboards[N] : pos->bitboards[n];
     while (pieces)
     {
         int sq = get_ls1b_index(pieces);
         attacks |= knight_attacks[sq];
-        pop_bit(pieces, sq);
+        pop_ls1b(pieces);
     }
 
-    pieces = (color == white) ? bitboards[B] : bitboards[b];
+    pieces = (color == white) ? pos->bitboards[B] : pos->bitboards[b];
     while (pieces)
     {
         int sq = get_ls1b_index(pieces);
-        attacks |= get_bishop_attacks_magic(sq, occupancies[both]);
-        pop_bit(pieces, sq);
+        attacks |= get_bishop_attacks_magic(sq, pos->occupancies[both]);
+        pop_ls1b(pieces);
     }
 
-    pieces = (color == white) ? bitboards[R] : bitboards[r];
+    pieces = (color == white) ? pos->bitboards[R] : pos->bitboards[r];
     while (pieces)
     {
         int sq = get_ls1b_index(pieces);
-        attacks |= get_rook_attacks_magic(sq, occupancies[both]);
-        pop_bit(pieces, sq);
+        attacks |= get_rook_attacks_magic(sq, pos->occupancies[both]);
+        pop_ls1b(pieces);
     }
 
-    pieces = (color == white) ? bitboards[Q] : bitboards[q];
+    pieces = (color == white) ? pos->bitboards[Q] : pos->bitboards[q];
     while (pieces)
     {
         int sq = get_ls1b_index(pieces);
-        attacks |= get_queen_attacks(sq, occupancies[both]);
-        pop_bit(pieces, sq);
+        attacks |= get_queen_attacks(sq, pos->occupancies[both]);
+        pop_ls1b(pieces);
     }
 
-    pieces = (color == white) ? bitboards[K] : bitboards[k];
+    pieces = (color == white) ? pos->bitboards[K] : pos->bitboards[k];
     if (pieces)
         attacks |= king_attacks[get_ls1b_index(pieces)];
 
     return attacks;
 }
 
-int calculate_constrictor_pressure(int color)
+int calculate_constrictor_pressure(const Position *pos, int color)
 {
     int enemy = color ^ 1;
-    int enemy_king = (enemy == white) ? get_ls1b_index(bitboards[K]) : get_ls1b_index(bitboards[k]);
+    int enemy_king = (enemy == white) ? get_ls1b_index(pos->bitboards[K]) : get_ls1b_index(pos->bitboards[k]);
     if (enemy_king == -1)
         return 0;
 
-    U64 our_attacks = attacks_by_color(color);
-    U64 enemy_attacks = attacks_by_color(enemy);
-    U64 enemy_pieces = occupancies[enemy];
+    U64 our_attacks = attacks_by_color(pos, color);
+    U64 enemy_attacks = attacks_by_color(pos, enemy);
+    U64 enemy_pieces = pos->occupancies[enemy];
     int pressure = 0;
 
     // Boa Constrictor idea: a quiet squeeze is strongest when the enemy king
@@ -575,25 +575,25 @@ int calculate_constrictor_pressure(int color)
     U64 dominated_king_zone = king_zone & our_attacks & ~enemy_attacks;
     pressure += count_bits(dominated_king_zone) * 14;
 
-    U64 minors = (enemy == white) ? (bitboards[N] | bitboards[B]) : (bitboards[n] | bitboards[b]);
+    U64 minors = (enemy == white) ? (pos->bitboards[N] | pos->bitboards[B]) : (pos->bitboards[n] | pos->bitboards[b]);
     while (minors)
     {
         int sq = get_ls1b_index(minors);
-        int mobility = count_bits((knight_attacks[sq] | get_bishop_attacks_magic(sq, occupancies[both])) & ~enemy_pieces);
+        int mobility = count_bits((knight_attacks[sq] | get_bishop_attacks_magic(sq, pos->occupancies[both])) & ~enemy_pieces);
         if (mobility <= 3)
             pressure += (4 - mobility) * 9;
-        pop_bit(minors, sq);
+        pop_ls1b(minors);
     }
 
     // Clamp advanced enemy pawns and reward blockades in front of passers.
-    U64 pawns = (enemy == white) ? bitboards[P] : bitboards[p];
+    U64 pawns = (enemy == white) ? pos->bitboards[P] : pos->bitboards[p];
     while (pawns)
     {
         int sq = get_ls1b_index(pawns);
         int front = (enemy == white) ? sq - 8 : sq + 8;
         if (front >= 0 && front < 64 && (our_attacks & (1ULL << front)))
             pressure += 5;
-        pop_bit(pawns, sq);
+        pop_ls1b(pawns);
     }
 
     return pressure;
@@ -603,15 +603,15 @@ int calculate_constrictor_pressure(int color)
 //           MAIN EVALUATION FUNCTION           \\
 // ============================================ \\
 
-int evaluate()
+int evaluate(const Position *pos)
 {
     // Try NNUE first
     if (use_nnue_eval && nnue_weights_loaded())
     {
-        return evaluate_nnue();
+        return evaluate_nnue(pos);
     }
 
-    if (has_insufficient_mating_material())
+    if (has_insufficient_mating_material(pos))
         return 0;
 
     int score = 0;
@@ -620,60 +620,60 @@ int evaluate()
 
     // Phase calculation
     int phase = 0;
-    phase += count_bits(bitboards[N] | bitboards[n]) * 1;
-    phase += count_bits(bitboards[B] | bitboards[b]) * 1;
-    phase += count_bits(bitboards[R] | bitboards[r]) * 2;
-    phase += count_bits(bitboards[Q] | bitboards[q]) * 4;
+    phase += count_bits(pos->bitboards[N] | pos->bitboards[n]) * 1;
+    phase += count_bits(pos->bitboards[B] | pos->bitboards[b]) * 1;
+    phase += count_bits(pos->bitboards[R] | pos->bitboards[r]) * 2;
+    phase += count_bits(pos->bitboards[Q] | pos->bitboards[q]) * 4;
     int total_phase = 24;
     int phase_score = (phase * 256 + total_phase / 2) / total_phase;
 
     // Bishop pair
-    if (count_bits(bitboards[B]) >= 2)
+    if (count_bits(pos->bitboards[B]) >= 2)
         score += bishop_pair_bonus;
-    if (count_bits(bitboards[b]) >= 2)
+    if (count_bits(pos->bitboards[b]) >= 2)
         score -= bishop_pair_bonus;
 
     // King positions
-    int white_king_sq = get_ls1b_index(bitboards[K]);
-    int black_king_sq = get_ls1b_index(bitboards[k]);
+    int white_king_sq = get_ls1b_index(pos->bitboards[K]);
+    int black_king_sq = get_ls1b_index(pos->bitboards[k]);
 
     // King safety (attack weight based)
-    int white_king_attack = count_king_attackers(black_king_sq, white);
-    int black_king_attack = count_king_attackers(white_king_sq, black);
+    int white_king_attack = count_king_attackers(pos, black_king_sq, white);
+    int black_king_attack = count_king_attackers(pos, white_king_sq, black);
     // Scale attack by game phase (more important in middlegame)
     score += white_king_attack * phase_score / 256;
     score -= black_king_attack * phase_score / 256;
 
     // Boa Constrictor evaluation
-    int white_space = calculate_space(white);
-    int black_space = calculate_space(black);
+    int white_space = calculate_space(pos, white);
+    int black_space = calculate_space(pos, black);
     score += (white_space - black_space) * space_bonus_mg;
 
-    int white_restriction = calculate_restriction(white);
-    int black_restriction = calculate_restriction(black);
+    int white_restriction = calculate_restriction(pos, white);
+    int black_restriction = calculate_restriction(pos, black);
     score -= white_restriction;
     score += black_restriction;
 
-    score += calculate_pawn_chain(white);
-    score -= calculate_pawn_chain(black);
+    score += calculate_pawn_chain(pos, white);
+    score -= calculate_pawn_chain(pos, black);
 
-    score += calculate_king_tropism(white);
-    score -= calculate_king_tropism(black);
+    score += calculate_king_tropism(pos, white);
+    score -= calculate_king_tropism(pos, black);
 
     // New Constrictor Pressure Map: value the slow denial of safe squares,
     // maintaining Fe64's identity as a boa-constrictor positional engine.
-    score += calculate_constrictor_pressure(white);
-    score -= calculate_constrictor_pressure(black);
+    score += calculate_constrictor_pressure(pos, white);
+    score -= calculate_constrictor_pressure(pos, black);
 
     // Trade bonus when ahead
     int material_imbalance = 0;
     for (int piece = P; piece <= k; piece++)
     {
-        material_imbalance += material_weights[piece] * count_bits(bitboards[piece]);
+        material_imbalance += material_weights[piece] * count_bits(pos->bitboards[piece]);
     }
     if (abs(material_imbalance) >= 100)
     {
-        int num_pieces = count_bits(occupancies[both]);
+        int num_pieces = count_bits(pos->occupancies[both]);
         int trade_bonus = (32 - num_pieces) * trade_bonus_per_100cp * abs(material_imbalance) / 100;
         if (material_imbalance > 0)
             score += trade_bonus;
@@ -684,7 +684,7 @@ int evaluate()
     // Piece evaluation
     for (int piece = P; piece <= k; piece++)
     {
-        bitboard = bitboards[piece];
+        bitboard = pos->bitboards[piece];
         while (bitboard)
         {
             square = get_ls1b_index(bitboard);
@@ -700,7 +700,7 @@ int evaluate()
                     U64 file_mask = 0x0101010101010101ULL << file;
 
                     // Doubled pawn penalty
-                    if (count_bits(file_mask & bitboards[P]) > 1)
+                    if (count_bits(file_mask & pos->bitboards[P]) > 1)
                         score -= doubled_pawn_penalty;
 
                     // Isolated pawn penalty
@@ -709,7 +709,7 @@ int evaluate()
                         adjacent_files |= 0x0101010101010101ULL << (file - 1);
                     if (file < 7)
                         adjacent_files |= 0x0101010101010101ULL << (file + 1);
-                    if (!(adjacent_files & bitboards[P]))
+                    if (!(adjacent_files & pos->bitboards[P]))
                         score -= isolated_pawn_penalty;
 
                     // Backward pawn penalty
@@ -722,13 +722,13 @@ int evaluate()
                         if (file < 7)
                             support_mask |= (1ULL << ((rank + 1) * 8 + file + 1));
                         U64 stop_sq = 1ULL << ((rank - 1) * 8 + file);
-                        if (!(support_mask & bitboards[P]) && (pawn_attacks[white][(rank - 1) * 8 + file] & bitboards[p]))
+                        if (!(support_mask & pos->bitboards[P]) && (pawn_attacks[white][(rank - 1) * 8 + file] & pos->bitboards[p]))
                             is_backward = 1;
                     }
                     if (is_backward)
                         score -= 15;
                 }
-                if (is_passed_pawn(square, white))
+                if (is_passed_pawn(pos, square, white))
                 {
                     int rank = square / 8;
                     if (phase_score <= 128)
@@ -745,20 +745,20 @@ int evaluate()
                         score += passed_pawn_bonus[rank];
                     }
                     // Protected passed pawn bonus
-                    if (pawn_attacks[black][square] & bitboards[P])
+                    if (pawn_attacks[black][square] & pos->bitboards[P])
                         score += 15;
                 }
                 break;
             case N:
                 score += knight_score[square];
-                score += count_bits(knight_attacks[square] & ~occupancies[white]) * 4;
-                if (is_outpost(square, white))
+                score += count_bits(knight_attacks[square] & ~pos->occupancies[white]) * 4;
+                if (is_outpost(pos, square, white))
                     score += knight_outpost_bonus;
                 break;
             case B:
                 score += bishop_score[square];
-                score += count_bits(get_bishop_attacks_magic(square, occupancies[both]) & ~occupancies[white]) * 5;
-                if (is_outpost(square, white))
+                score += count_bits(get_bishop_attacks_magic(square, pos->occupancies[both]) & ~pos->occupancies[white]) * 5;
+                if (is_outpost(pos, square, white))
                     score += bishop_outpost_bonus;
                 break;
             case R:
@@ -767,21 +767,21 @@ int evaluate()
                     int file = square % 8;
                     int rank = square / 8;
                     U64 file_mask = 0x0101010101010101ULL << file;
-                    if (!(file_mask & (bitboards[P] | bitboards[p])))
+                    if (!(file_mask & (pos->bitboards[P] | pos->bitboards[p])))
                         score += rook_open_file_bonus;
-                    else if (!(file_mask & bitboards[P]))
+                    else if (!(file_mask & pos->bitboards[P]))
                         score += rook_semi_open_bonus;
                     if (rank == 1)
                         score += seventh_rank_rook_bonus;
                     // Connected rooks bonus
-                    U64 rook_ray = get_rook_attacks_magic(square, occupancies[both]);
-                    if (rook_ray & bitboards[R] & ~(1ULL << square))
+                    U64 rook_ray = get_rook_attacks_magic(square, pos->occupancies[both]);
+                    if (rook_ray & pos->bitboards[R] & ~(1ULL << square))
                         score += connected_rooks_bonus;
                 }
-                score += count_bits(get_rook_attacks_magic(square, occupancies[both]) & ~occupancies[white]) * 2;
+                score += count_bits(get_rook_attacks_magic(square, pos->occupancies[both]) & ~pos->occupancies[white]) * 2;
                 break;
             case Q:
-                score += count_bits(get_queen_attacks(square, occupancies[both]) & ~occupancies[white]) * 1;
+                score += count_bits(get_queen_attacks(square, pos->occupancies[both]) & ~pos->occupancies[white]) * 1;
                 break;
             case K:
                 if (phase_score <= 128)
@@ -789,7 +789,7 @@ int evaluate()
                 else
                 {
                     score += king_score[square];
-                    U64 shelter_mask = king_attacks[square] & bitboards[P];
+                    U64 shelter_mask = king_attacks[square] & pos->bitboards[P];
                     score += count_bits(shelter_mask) * pawn_shelter_bonus;
                 }
                 break;
@@ -801,7 +801,7 @@ int evaluate()
                     U64 file_mask = 0x0101010101010101ULL << file;
 
                     // Doubled pawn penalty
-                    if (count_bits(file_mask & bitboards[p]) > 1)
+                    if (count_bits(file_mask & pos->bitboards[p]) > 1)
                         score += doubled_pawn_penalty;
 
                     // Isolated pawn penalty
@@ -810,7 +810,7 @@ int evaluate()
                         adjacent_files |= 0x0101010101010101ULL << (file - 1);
                     if (file < 7)
                         adjacent_files |= 0x0101010101010101ULL << (file + 1);
-                    if (!(adjacent_files & bitboards[p]))
+                    if (!(adjacent_files & pos->bitboards[p]))
                         score += isolated_pawn_penalty;
 
                     // Backward pawn penalty
@@ -823,13 +823,13 @@ int evaluate()
                         if (file < 7)
                             support_mask |= (1ULL << ((rank - 1) * 8 + file + 1));
                         U64 stop_sq = 1ULL << ((rank + 1) * 8 + file);
-                        if (!(support_mask & bitboards[p]) && (pawn_attacks[black][(rank + 1) * 8 + file] & bitboards[P]))
+                        if (!(support_mask & pos->bitboards[p]) && (pawn_attacks[black][(rank + 1) * 8 + file] & pos->bitboards[P]))
                             is_backward = 1;
                     }
                     if (is_backward)
                         score += 15;
                 }
-                if (is_passed_pawn(square, black))
+                if (is_passed_pawn(pos, square, black))
                 {
                     int rank = square / 8;
                     if (phase_score <= 128)
@@ -845,20 +845,20 @@ int evaluate()
                         score -= passed_pawn_bonus[7 - rank];
                     }
                     // Protected passed pawn bonus
-                    if (pawn_attacks[white][square] & bitboards[p])
+                    if (pawn_attacks[white][square] & pos->bitboards[p])
                         score -= 15;
                 }
                 break;
             case n:
                 score -= knight_score[square ^ 56];
-                score -= count_bits(knight_attacks[square] & ~occupancies[black]) * 4;
-                if (is_outpost(square, black))
+                score -= count_bits(knight_attacks[square] & ~pos->occupancies[black]) * 4;
+                if (is_outpost(pos, square, black))
                     score -= knight_outpost_bonus;
                 break;
             case b:
                 score -= bishop_score[square ^ 56];
-                score -= count_bits(get_bishop_attacks_magic(square, occupancies[both]) & ~occupancies[black]) * 5;
-                if (is_outpost(square, black))
+                score -= count_bits(get_bishop_attacks_magic(square, pos->occupancies[both]) & ~pos->occupancies[black]) * 5;
+                if (is_outpost(pos, square, black))
                     score -= bishop_outpost_bonus;
                 break;
             case r:
@@ -867,21 +867,21 @@ int evaluate()
                     int file = square % 8;
                     int rank = square / 8;
                     U64 file_mask = 0x0101010101010101ULL << file;
-                    if (!(file_mask & (bitboards[P] | bitboards[p])))
+                    if (!(file_mask & (pos->bitboards[P] | pos->bitboards[p])))
                         score -= rook_open_file_bonus;
-                    else if (!(file_mask & bitboards[p]))
+                    else if (!(file_mask & pos->bitboards[p]))
                         score -= rook_semi_open_bonus;
                     if (rank == 6)
                         score -= seventh_rank_rook_bonus;
                     // Connected rooks bonus
-                    U64 rook_ray = get_rook_attacks_magic(square, occupancies[both]);
-                    if (rook_ray & bitboards[r] & ~(1ULL << square))
+                    U64 rook_ray = get_rook_attacks_magic(square, pos->occupancies[both]);
+                    if (rook_ray & pos->bitboards[r] & ~(1ULL << square))
                         score -= connected_rooks_bonus;
                 }
-                score -= count_bits(get_rook_attacks_magic(square, occupancies[both]) & ~occupancies[black]) * 2;
+                score -= count_bits(get_rook_attacks_magic(square, pos->occupancies[both]) & ~pos->occupancies[black]) * 2;
                 break;
             case q:
-                score -= count_bits(get_queen_attacks(square, occupancies[both]) & ~occupancies[black]) * 1;
+                score -= count_bits(get_queen_attacks(square, pos->occupancies[both]) & ~pos->occupancies[black]) * 1;
                 break;
             case k:
                 if (phase_score <= 128)
@@ -889,12 +889,12 @@ int evaluate()
                 else
                 {
                     score -= king_score[square ^ 56];
-                    U64 shelter_mask = king_attacks[square] & bitboards[p];
+                    U64 shelter_mask = king_attacks[square] & pos->bitboards[p];
                     score -= count_bits(shelter_mask) * pawn_shelter_bonus;
                 }
                 break;
             }
-            pop_bit(bitboard, square);
+            pop_ls1b(bitboard);
         }
     }
 
@@ -912,7 +912,7 @@ int evaluate()
     }
 
     // Tempo
-    score += (side == white) ? 10 : -10;
+    score += (pos->side == white) ? 10 : -10;
 
-    return (side == white) ? score : -score;
+    return (pos->side == white) ? score : -score;
 }
@@ -11,9 +11,9 @@
 // External function declarations - Initialization
 extern void init_leapers_attacks();
 extern void init_sliders_attacks(int bishop);
+extern void init_line_tables();
 extern void init_hash_keys();
 extern void init_lmr_table();
-extern U64 generate_hash_key();
 extern void clear_tt();
 extern void init_tt(int mb);
 
@@ -45,24 +45,13 @@ int main(int argc, char *argv[])
     init_leapers_attacks();  // Initialize pawn, knight, king attacks
     init_sliders_attacks(1); // Initialize bishop attacks (1 = bishop)
     init_sliders_attacks(0); // Initialize rook attacks (0 = rook)
+    init_line_tables();      // Squares between / lines through two squares
 
     init_hash_keys();
     init_lmr_table(); // Initialize Late Move Reduction table
 
-    hash_key = generate_hash_key();
     init_tt(hash_size_mb); // Initialize TT with configured hash size
 
-    // Clear search tables
-    memset(killer_moves, 0, sizeof(killer_moves));
-    memset(history_moves, 0, sizeof(history_moves));
-    memset(pv_table, 0, sizeof(pv_table));
-    memset(pv_length, 0, sizeof(pv_length));
-    memset(counter_moves, 0, sizeof(counter_moves));
-    memset(butterfly_history, 0, sizeof(butterfly_history));
-    memset(last_move_made, 0, sizeof(last_move_made));
-
-    repetition_index = 0;
-
     // Try to load the strongest bundled Polyglot books. Keeping several
     // curated books available gives Fe64 broader opening knowledge while
     // still using its own search/evaluation once the book ends.
@@ -8,8 +8,11 @@
 extern U64 get_bishop_attacks_magic(int square, U64 occupancy);
 extern U64 get_rook_attacks_magic(int square, U64 occupancy);
 extern U64 get_queen_attacks(int square, U64 block);
-extern int is_square_attacked(int square, int side_attacking);
-extern U64 generate_hash_key();
+extern int is_square_attacked(const Position *pos, int square, int side_attacking);
+extern U64 generate_hash_key(const Position *pos);
+extern U64 attackers_to(const Position *pos, int square, U64 occupancy);
+extern const U64 not_a_file;
+extern const U64 not_h_file;
 
 // ============================================ \\
 //           MOVE LIST HELPERS                  \\
@@ -17,10 +20,37 @@ extern U64 generate_hash_key();
 
 void add_move(moves *move_list, int move)
 {
-    move_list->moves[move_list->count] = move;
+    move_list->moves[move_list->count] = pack_move(move);
     move_list->count++;
 }
 
+// Rebuild the full move from its packed form using the mailbox; the piece
+// and flag bits come out exactly as the generators encode them. A packed
+// move from another position (hash collision, killer, book) may be
+// nonsense here, so check it with is_pseudo_legal() before trusting it.
+int decode_with_position(const Position *pos, move16 packed)
+{
+    if (!packed)
+        return 0;
+
+    int source = get_move_source(packed);
+    int target = get_move_target(packed);
+    int piece = pos->piece_on[source];
+    if (piece == no_piece || (piece >= p) != pos->side)
+        return 0;
+
+    int pawn = (piece == P || piece == p);
+    int king = (piece == K || piece == k);
+    int distance = abs(target - source);
+    int capture = get_bit(pos->occupancies[pos->side ^ 1], target) ? 1 : 0;
+    int enpassant = pawn && target == pos->en_passant && (source % 8) != (target % 8);
+    if (enpassant)
+        capture = 1;
+
+    return encode_move(source, target, piece, (packed >> 12), capture,
+                       (pawn && distance == 16), enpassant, (king && distance == 2));
+}
+
 void print_move(int move)
 {
     printf("%c%d%c%d",
@@ -60,399 +90,798 @@ void print_move(int move)
 }
 
 // ============================================ \\
-//           MOVE GENERATION                    \\
+//           MAKE / UNMAKE MOVE                 \\
 // ============================================ \\
 
-void generate_moves(moves *move_list)
+void unmake_move(Position *pos, int move, const undo_info *undo);
+
+// Move a castling rook; the hash is handled by the caller
+static void shift_rook(Position *pos, int rook, int from, int to)
 {
-    move_list->count = 0;
+    U64 from_to = (1ULL << from) | (1ULL << to);
+    pos->bitboards[rook] ^= from_to;
+    pos->occupancies[rook == R ? white : black] ^= from_to;
+    pos->piece_on[from] = no_piece;
+    pos->piece_on[to] = rook;
+}
 
-    int source_square, target_square;
-    U64 bitboard, attacks;
+// Square of the pawn removed by an en passant capture
+#define enpassant_victim(side, target) ((side) == white ? (target) + 8 : (target) - 8)
 
-    // ===== PAWN MOVES =====
-    if (side == white)
+// Play 'move', saving what cannot be recomputed into 'undo'. Occupancies
+// are updated incrementally. An illegal move is undone before returning 0;
+// with 'legal_move' the check is skipped.
+int make_move(Position *pos, int move, int move_flag, undo_info *undo)
+{
+    if (move_flag == only_captures)
     {
-        bitboard = bitboards[P];
-        while (bitboard)
-        {
-            source_square = get_ls1b_index(bitboard);
-            target_square = source_square - 8;
+        if (!get_move_capture(move))
+            return 0;
+    }
 
-            if (!(target_square < a8) && !get_bit(occupancies[both], target_square))
-            {
-                // Promotion
-                if (source_square >= a7 && source_square <= h7)
-                {
-                    add_move(move_list, encode_move(source_square, target_square, P, Q, 0, 0, 0, 0));
-                    add_move(move_list, encode_move(source_square, target_square, P, R, 0, 0, 0, 0));
-                    add_move(move_list, encode_move(source_square, target_square, P, B, 0, 0, 0, 0));
-                    add_move(move_list, encode_move(source_square, target_square, P, N, 0, 0, 0, 0));
-                }
-                else
-                {
-                    add_move(move_list, encode_move(source_square, target_square, P, 0, 0, 0, 0, 0));
-                    // Double push
-                    if ((source_square >= a2 && source_square <= h2) && !get_bit(occupancies[both], target_square - 8))
-                    {
-                        add_move(move_list, encode_move(source_square, target_square - 8, P, 0, 0, 1, 0, 0));
-                    }
-                }
-            }
+    int source_square = get_move_source(move);
+    int target_square = get_move_target(move);
+    int piece = get_move_piece(move);
+    int promoted_piece = get_move_promoted(move);
+    int capture = get_move_capture(move);
+    int double_push = get_move_double(move);
+    int enpass = get_move_enpassant(move);
+    int castling = get_move_castling(move);
+    int us = pos->side;
+    int them = us ^ 1;
 
-            // Captures
-            attacks = pawn_attacks[white][source_square] & occupancies[black];
-            while (attacks)
-            {
-                target_square = get_ls1b_index(attacks);
-                if (source_square >= a7 && source_square <= h7)
-                {
-                    add_move(move_list, encode_move(source_square, target_square, P, Q, 1, 0, 0, 0));
-                    add_move(move_list, encode_move(source_square, target_square, P, R, 1, 0, 0, 0));
-                    add_move(move_list, encode_move(source_square, target_square, P, B, 1, 0, 0, 0));
-                    add_move(move_list, encode_move(source_square, target_square, P, N, 1, 0, 0, 0));
-                }
-                else
-                {
-                    add_move(move_list, encode_move(source_square, target_square, P, 0, 1, 0, 0, 0));
-                }
-                pop_bit(attacks, target_square);
-            }
+    undo->captured = no_piece;
+    undo->castle = pos->castle;
+    undo->en_passant = pos->en_passant;
+    undo->hash_key = pos->hash_key;
 
-            // En Passant
-            if (en_passant != no_sq)
-            {
-                U64 enpassant_attacks = pawn_attacks[white][source_square] & (1ULL << en_passant);
-                if (enpassant_attacks)
-                {
-                    int target_enpassant = get_ls1b_index(enpassant_attacks);
-                    add_move(move_list, encode_move(source_square, target_enpassant, P, 0, 1, 0, 1, 0));
-                }
-            }
-            pop_bit(bitboard, source_square);
+    // New NNUE entry: only the board changes, the sums come later
+    NNUEAccumulator *acc = &pos->nnue_stack[++pos->nnue_top];
+    acc->computed = 0;
+    acc->refresh = 0;
+    acc->num_added = 0;
+    acc->num_removed = 0;
+
+    // Remove the captured piece first so the mover can land on its square
+    if (capture)
+    {
+        int capture_square = enpass ? enpassant_victim(us, target_square) : target_square;
+        int captured = pos->piece_on[capture_square];
+        if (captured != no_piece)
+        {
+            pop_bit(pos->bitboards[captured], capture_square);
+            pop_bit(pos->occupancies[them], capture_square);
+            pos->hash_key ^= piece_keys[captured][capture_square];
+            pos->piece_on[capture_square] = no_piece;
+            undo->captured = captured;
+            nnue_remove_feature(acc, captured, capture_square);
         }
     }
-    else
+
+    // Move piece
+    U64 from_to = (1ULL << source_square) | (1ULL << target_square);
+    pos->bitboards[piece] ^= from_to;
+    pos->occupancies[us] ^= from_to;
+    pos->hash_key ^= piece_keys[piece][source_square];
+    pos->hash_key ^= piece_keys[piece][target_square];
+    pos->piece_on[source_square] = no_piece;
+    pos->piece_on[target_square] = piece;
+    nnue_remove_feature(acc, piece, source_square);
+    nnue_add_feature(acc, promoted_piece ? promoted_piece : piece, target_square);
+    if ((piece == K || piece == k) && nnue_king_key(us, source_square) != nnue_king_key(us, target_square))
+        acc->refresh = 1 << us;
+
+    // Handle promotions
+    if (promoted_piece)
     {
-        // BLACK PAWNS
-        bitboard = bitboards[p];
-        while (bitboard)
-        {
-            source_square = get_ls1b_index(bitboard);
-            target_square = source_square + 8;
+        pop_bit(pos->bitboards[piece], target_square);
+        set_bit(pos->bitboards[promoted_piece], target_square);
+        pos->hash_key ^= piece_keys[piece][target_square];
+        pos->hash_key ^= piece_keys[promoted_piece][target_square];
+        pos->piece_on[target_square] = promoted_piece;
+    }
 
-            if (!(target_square > h1) && !get_bit(occupancies[both], target_square))
-            {
-                if (source_square >= a2 && source_square <= h2)
-                {
-                    add_move(move_list, encode_move(source_square, target_square, p, q, 0, 0, 0, 0));
-                    add_move(move_list, encode_move(source_square, target_square, p, r, 0, 0, 0, 0));
-                    add_move(move_list, encode_move(source_square, target_square, p, b, 0, 0, 0, 0));
-                    add_move(move_list, encode_move(source_square, target_square, p, n, 0, 0, 0, 0));
-                }
-                else
-                {
-                    add_move(move_list, encode_move(source_square, target_square, p, 0, 0, 0, 0, 0));
-                    if ((source_square >= a7 && source_square <= h7) && !get_bit(occupancies[both], target_square + 8))
-                    {
-                        add_move(move_list, encode_move(source_square, target_square + 8, p, 0, 0, 1, 0, 0));
-                    }
-                }
-            }
+    // Update en passant state
+    if (pos->en_passant != no_sq)
+        pos->hash_key ^= enpassant_keys[pos->en_passant];
+    pos->en_passant = no_sq;
 
-            attacks = pawn_attacks[black][source_square] & occupancies[white];
-            while (attacks)
-            {
-                target_square = get_ls1b_index(attacks);
-                if (source_square >= a2 && source_square <= h2)
-                {
-                    add_move(move_list, encode_move(source_square, target_square, p, q, 1, 0, 0, 0));
-                    add_move(move_list, encode_move(source_square, target_square, p, r, 1, 0, 0, 0));
-                    add_move(move_list, encode_move(source_square, target_square, p, b, 1, 0, 0, 0));
-                    add_move(move_list, encode_move(source_square, target_square, p, n, 1, 0, 0, 0));
-                }
-                else
-                {
-                    add_move(move_list, encode_move(source_square, target_square, p, 0, 1, 0, 0, 0));
-                }
-                pop_bit(attacks, target_square);
-            }
+    if (double_push)
+    {
+        pos->en_passant = enpassant_victim(us, target_square);
+        pos->hash_key ^= enpassant_keys[pos->en_passant];
+    }
 
-            if (en_passant != no_sq)
-            {
-                U64 enpassant_attacks = pawn_attacks[black][source_square] & (1ULL << en_passant);
-                if (enpassant_attacks)
-                {
-                    int target_enpassant = get_ls1b_index(enpassant_attacks);
-                    add_move(move_list, encode_move(source_square, target_enpassant, p, 0, 1, 0, 1, 0));
-                }
-            }
-            pop_bit(bitboard, source_square);
-        }
+    // Handle castling rook moves
+    if (castling)
+    {
+        int rook = (us == white) ? R : r;
+        int rook_from = (target_square == g1) ? h1 : (target_square == c1) ? a1 : (target_square == g8) ? h8 : a8;
+        int rook_to = (target_square == g1) ? f1 : (target_square == c1) ? d1 : (target_square == g8) ? f8 : d8;
+        shift_rook(pos, rook, rook_from, rook_to);
+        pos->hash_key ^= piece_keys[rook][rook_from] ^ piece_keys[rook][rook_to];
+        nnue_remove_feature(acc, rook, rook_from);
+        nnue_add_feature(acc, rook, rook_to);
     }
 
-    // ===== CASTLING MOVES =====
-    if (side == white)
+    // Update castling rights
+    pos->hash_key ^= castle_keys[pos->castle];
+    pos->castle &= castling_rights[source_square];
+    pos->castle &= castling_rights[target_square];
+    pos->hash_key ^= castle_keys[pos->castle];
+
+    pos->occupancies[both] = pos->occupancies[white] | pos->occupancies[black];
+
+    // Change side
+    pos->side ^= 1;
+    pos->hash_key ^= side_key;
+
+    // The child key is final: start pulling its TT cluster into cache
+    prefetch_tt(pos->hash_key);
+
+    // Legality check
+    if (move_flag != legal_move &&
+        is_square_attacked(pos, (pos->side == white) ? get_ls1b_index(pos->bitboards[k]) : get_ls1b_index(pos->bitboards[K]), pos->side))
     {
-        if (castle & wk)
-        {
-            if (!get_bit(occupancies[both], f1) && !get_bit(occupancies[both], g1))
-            {
-                if (!is_square_attacked(e1, black) && !is_square_attacked(f1, black) && !is_square_attacked(g1, black))
-                {
-                    add_move(move_list, encode_move(e1, g1, K, 0, 0, 0, 0, 1));
-                }
-            }
-        }
-        if (castle & wq)
-        {
-            if (!get_bit(occupancies[both], d1) && !get_bit(occupancies[both], c1) && !get_bit(occupancies[both], b1))
-            {
-                if (!is_square_attacked(e1, black) && !is_square_attacked(d1, black) && !is_square_attacked(c1, black))
-                {
-                    add_move(move_list, encode_move(e1, c1, K, 0, 0, 0, 0, 1));
-                }
-            }
-        }
+        unmake_move(pos, move, undo);
+        return 0;
     }
-    else
+    return 1;
+}
+
+// Take back a move played by make_move() with the same undo record
+void unmake_move(Position *pos, int move, const undo_info *undo)
+{
+    int source_square = get_move_source(move);
+    int target_square = get_move_target(move);
+    int piece = get_move_piece(move);
+    int promoted_piece = get_move_promoted(move);
+
+    pos->nnue_top--;
+    pos->side ^= 1;
+    int us = pos->side;
+    int them = us ^ 1;
+
+    if (promoted_piece)
     {
-        if (castle & bk)
-        {
-            if (!get_bit(occupancies[both], f8) && !get_bit(occupancies[both], g8))
-            {
-                if (!is_square_attacked(e8, white) && !is_square_attacked(f8, white) && !is_square_attacked(g8, white))
-                {
-                    add_move(move_list, encode_move(e8, g8, k, 0, 0, 0, 0, 1));
-                }
-            }
-        }
-        if (castle & bq)
+        pop_bit(pos->bitboards[promoted_piece], target_square);
+        set_bit(pos->bitboards[piece], target_square);
+    }
+
+    U64 from_to = (1ULL << source_square) | (1ULL << target_square);
+    pos->bitboards[piece] ^= from_to;
+    pos->occupancies[us] ^= from_to;
+    pos->piece_on[target_square] = no_piece;
+    pos->piece_on[source_square] = piece;
+
+    if (get_move_castling(move))
+    {
+        switch (target_square)
         {
-            if (!get_bit(occupancies[both], d8) && !get_bit(occupancies[both], c8) && !get_bit(occupancies[both], b8))
-            {
-                if (!is_square_attacked(e8, white) && !is_square_attacked(d8, white) && !is_square_attacked(c8, white))
-                {
-                    add_move(move_list, encode_move(e8, c8, k, 0, 0, 0, 0, 1));
-                }
-            }
+        case g1:
+            shift_rook(pos, R, f1, h1);
+            break;
+        case c1:
+            shift_rook(pos, R, d1, a1);
+            break;
+        case g8:
+            shift_rook(pos, r, f8, h8);
+            break;
+        case c8:
+            shift_rook(pos, r, d8, a8);
+            break;
         }
     }
 
-    // ===== PIECE MOVES (Knight, Bishop, Rook, Queen, King) =====
-    int p_start = (side == white) ? N : n;
-    int p_end = (side == white) ? K : k;
-
-    for (int piece = p_start; piece <= p_end; piece++)
+    if (undo->captured != no_piece)
     {
-        bitboard = bitboards[piece];
+        int capture_square = get_move_enpassant(move) ? enpassant_victim(us, target_square) : target_square;
+        set_bit(pos->bitboards[undo->captured], capture_square);
+        set_bit(pos->occupancies[them], capture_square);
+        pos->piece_on[capture_square] = undo->captured;
+    }
 
-        while (bitboard)
-        {
-            source_square = get_ls1b_index(bitboard);
+    pos->occupancies[both] = pos->occupancies[white] | pos->occupancies[black];
+    pos->castle = undo->castle;
+    pos->en_passant = undo->en_passant;
+    pos->hash_key = undo->hash_key;
+}
 
-            if (side == white)
-            {
-                if (piece == N)
-                    attacks = knight_attacks[source_square];
-                else if (piece == B)
-                    attacks = get_bishop_attacks_magic(source_square, occupancies[both]);
-                else if (piece == R)
-                    attacks = get_rook_attacks_magic(source_square, occupancies[both]);
-                else if (piece == Q)
-                    attacks = get_queen_attacks(source_square, occupancies[both]);
-                else if (piece == K)
-                    attacks = king_attacks[source_square];
-                attacks &= ~occupancies[white];
-            }
-            else
-            {
-                if (piece == n)
-                    attacks = knight_attacks[source_square];
-                else if (piece == b)
-                    attacks = get_bishop_attacks_magic(source_square, occupancies[both]);
-                else if (piece == r)
-                    attacks = get_rook_attacks_magic(source_square, occupancies[both]);
-                else if (piece == q)
-                    attacks = get_queen_attacks(source_square, occupancies[both]);
-                else if (piece == k)
-                    attacks = king_attacks[source_square];
-                attacks &= ~occupancies[black];
-            }
+// Pass the move to the opponent: only the side, en passant square and key
+// change
+void make_null_move(Position *pos, undo_info *undo)
+{
+    undo->captured = no_piece;
+    undo->castle = pos->castle;
+    undo->en_passant = pos->en_passant;
+    undo->hash_key = pos->hash_key;
 
-            while (attacks)
-            {
-                target_square = get_ls1b_index(attacks);
-                int capture = get_bit(occupancies[(!side) ? black : white], target_square) ? 1 : 0;
-                add_move(move_list, encode_move(source_square, target_square, piece, 0, capture, 0, 0, 0));
-                pop_bit(attacks, target_square);
-            }
-            pop_bit(bitboard, source_square);
-        }
+    if (pos->en_passant != no_sq)
+    {
+        pos->hash_key ^= enpassant_keys[pos->en_passant];
+        pos->en_passant = no_sq;
     }
+    pos->side ^= 1;
+    pos->hash_key ^= side_key;
+    prefetch_tt(pos->hash_key);
+
+    // No feature changes: the entry just repeats its parent
+    NNUEAccumulator *acc = &pos->nnue_stack[++pos->nnue_top];
+    acc->computed = 0;
+    acc->refresh = 0;
+    acc->num_added = 0;
+    acc->num_removed = 0;
+}
+
+void unmake_null_move(Position *pos, const undo_info *undo)
+{
+    pos->nnue_top--;
+    pos->side ^= 1;
+    pos->en_passant = undo->en_passant;
+    pos->hash_key = undo->hash_key;
 }
 
 // ============================================ \\
-//           MAKE MOVE                          \\
+//           LEGAL MOVE GENERATION              \\
 // ============================================ \\
 
-int make_move(int move, int move_flag)
+// Every square 'side' attacks with the given occupancy
+static U64 attacked_squares(const Position *pos, int side, U64 occupancy)
 {
-    if (move_flag == only_captures)
+    int base = (side == white) ? P : p;
+    U64 pawns = pos->bitboards[base];
+    U64 attacks = (side == white) ? (((pawns >> 7) & not_a_file) | ((pawns >> 9) & not_h_file))
+                                  : (((pawns << 9) & not_a_file) | ((pawns << 7) & not_h_file));
+    U64 bitboard;
+
+    bitboard = pos->bitboards[base + 1];
+    while (bitboard)
     {
-        if (!get_move_capture(move))
-            return 0;
+        attacks |= knight_attacks[get_ls1b_index(bitboard)];
+        pop_ls1b(bitboard);
+    }
+
+    bitboard = pos->bitboards[base + 2] | pos->bitboards[base + 4];
+    while (bitboard)
+    {
+        attacks |= get_bishop_attacks_magic(get_ls1b_index(bitboard), occupancy);
+        pop_ls1b(bitboard);
+    }
+
+    bitboard = pos->bitboards[base + 3] | pos->bitboards[base + 4];
+    while (bitboard)
+    {
+        attacks |= get_rook_attacks_magic(get_ls1b_index(bitboard), occupancy);
+        pop_ls1b(bitboard);
     }
 
-    copy_board();
+    return attacks | king_attacks[get_ls1b_index(pos->bitboards[base + 5])];
+}
+
+// Pieces (of either side) that are the only blocker between a slider of
+// 'slider_side' and the king on 'king_square': pins when they are the
+// king's own, discovered-check candidates when they are the slider's
+static U64 blockers_for(const Position *pos, int king_square, int slider_side)
+{
+    int base = (slider_side == white) ? P : p;
+    U64 blockers = 0ULL;
+
+    U64 snipers = (get_bishop_attacks_magic(king_square, 0ULL) & (pos->bitboards[base + 2] | pos->bitboards[base + 4])) |
+                  (get_rook_attacks_magic(king_square, 0ULL) & (pos->bitboards[base + 3] | pos->bitboards[base + 4]));
+    while (snipers)
+    {
+        U64 between = between_squares[king_square][get_ls1b_index(snipers)] & pos->occupancies[both];
+        if (between && !(between & (between - 1)))
+            blockers |= between;
+        pop_ls1b(snipers);
+    }
+    return blockers;
+}
+
+// En passant removes two pieces from one rank, so check the king directly
+static int enpassant_is_legal(const Position *pos, int source_square, int target_square, int king_square, U64 checkers)
+{
+    int us = pos->side;
+    int base = (us == white) ? p : P; // enemy pieces
+    int victim = enpassant_victim(us, target_square);
+
+    // A pawn or knight check can only be answered by taking the checker
+    if (checkers & ~(1ULL << victim) & (pos->bitboards[base] | pos->bitboards[base + 1]))
+        return 0;
+
+    U64 occupancy = (pos->occupancies[both] ^ (1ULL << source_square) ^ (1ULL << victim)) | (1ULL << target_square);
+    return !(get_bishop_attacks_magic(king_square, occupancy) & (pos->bitboards[base + 2] | pos->bitboards[base + 4])) &&
+           !(get_rook_attacks_magic(king_square, occupancy) & (pos->bitboards[base + 3] | pos->bitboards[base + 4]));
+}
+
+// Fill 'ci' for the side to move
+void init_check_info(const Position *pos, CheckInfo *ci)
+{
+    int us = pos->side;
+    int them = us ^ 1;
+    int king_square = get_ls1b_index(pos->bitboards[(us == white) ? K : k]);
+    int their_king = get_ls1b_index(pos->bitboards[(them == white) ? K : k]);
+    U64 occupancy = pos->occupancies[both];
 
+    ci->king_square = their_king;
+    ci->checkers = attackers_to(pos, king_square, occupancy) & pos->occupancies[them];
+    ci->pinned = blockers_for(pos, king_square, them) & pos->occupancies[us];
+    ci->discoverers = blockers_for(pos, their_king, us) & pos->occupancies[us];
+
+    ci->check_squares[0] = pawn_attacks[them][their_king];
+    ci->check_squares[1] = knight_attacks[their_king];
+    ci->check_squares[2] = get_bishop_attacks_magic(their_king, occupancy);
+    ci->check_squares[3] = get_rook_attacks_magic(their_king, occupancy);
+    ci->check_squares[4] = ci->check_squares[2] | ci->check_squares[3];
+    ci->check_squares[5] = 0ULL;
+}
+
+// Does the legal 'move' check the enemy king? Decided from 'ci' without
+// making the move.
+int gives_check(const Position *pos, const CheckInfo *ci, int move)
+{
     int source_square = get_move_source(move);
     int target_square = get_move_target(move);
     int piece = get_move_piece(move);
     int promoted_piece = get_move_promoted(move);
-    int capture = get_move_capture(move);
-    int double_push = get_move_double(move);
-    int enpass = get_move_enpassant(move);
-    int castling = get_move_castling(move);
+    int base = (pos->side == white) ? P : p;
+    int their_king = ci->king_square;
 
-    // Move piece
-    pop_bit(bitboards[piece], source_square);
-    set_bit(bitboards[piece], target_square);
-    hash_key ^= piece_keys[piece][source_square];
-    hash_key ^= piece_keys[piece][target_square];
+    // Direct check
+    if (!promoted_piece && get_bit(ci->check_squares[piece - base], target_square))
+        return 1;
+
+    // Discovered check: the piece leaves the line to the enemy king
+    if (get_bit(ci->discoverers, source_square) && !get_bit(line_through[their_king][source_square], target_square))
+        return 1;
+
+    U64 occupancy = pos->occupancies[both] ^ (1ULL << source_square);
+
+    // The promoted piece sees through the square the pawn left
+    if (promoted_piece)
+    {
+        U64 attacks = 0ULL;
+        if (promoted_piece == base + 1)
+            attacks = knight_attacks[target_square];
+        if (promoted_piece == base + 2 || promoted_piece == base + 4)
+            attacks |= get_bishop_attacks_magic(target_square, occupancy);
+        if (promoted_piece == base + 3 || promoted_piece == base + 4)
+            attacks |= get_rook_attacks_magic(target_square, occupancy);
+        return get_bit(attacks, their_king) ? 1 : 0;
+    }
+
+    // En passant can uncover a check through the captured pawn too
+    if (get_move_enpassant(move))
+    {
+        int victim = enpassant_victim(pos->side, target_square);
+        occupancy = (occupancy ^ (1ULL << victim)) | (1ULL << target_square);
+        return ((get_bishop_attacks_magic(their_king, occupancy) & (pos->bitboards[base + 2] | pos->bitboards[base + 4])) ||
+                (get_rook_attacks_magic(their_king, occupancy) & (pos->bitboards[base + 3] | pos->bitboards[base + 4])))
+                   ? 1
+                   : 0;
+    }
+
+    // Castling checks with the rook
+    if (get_move_castling(move))
+    {
+        int rook_from = (target_square == g1) ? h1 : (target_square == c1) ? a1 : (target_square == g8) ? h8 : a8;
+        int rook_to = (target_square == g1) ? f1 : (target_square == c1) ? d1 : (target_square == g8) ? f8 : d8;
+        occupancy = (occupancy ^ (1ULL << rook_from)) | (1ULL << target_square) | (1ULL << rook_to);
+        return get_bit(get_rook_attacks_magic(rook_to, occupancy), their_king) ? 1 : 0;
+    }
+
+    return 0;
+}
+
+// Could the generator have produced 'move' here? The packed fields are
+// checked against the board, so a hash or killer move from another
+// position is rejected without generating anything. Pins, checks and the
+// castling path are left to is_legal().
+int is_pseudo_legal(const Position *pos, int move)
+{
+    if (!move)
+        return 0;
+
+    int us = pos->side;
+    int base = (us == white) ? P : p;
+    int source_square = get_move_source(move);
+    int target_square = get_move_target(move);
+    int piece = get_move_piece(move);
+    int promoted_piece = get_move_promoted(move);
+    int capture = get_move_capture(move) ? 1 : 0;
+    int double_push = get_move_double(move) ? 1 : 0;
+    int enpass = get_move_enpassant(move) ? 1 : 0;
+    int castling = get_move_castling(move) ? 1 : 0;
+    U64 occupancy = pos->occupancies[both];
+    U64 enemy = pos->occupancies[us ^ 1];
+
+    if (piece < base || piece > base + 5 || pos->piece_on[source_square] != piece ||
+        get_bit(pos->occupancies[us], target_square))
+        return 0;
+
+    if (castling)
+    {
+        if (piece != base + 5 || capture || promoted_piece || double_push || enpass)
+            return 0;
+        if (us == white)
+            return (source_square == e1 && target_square == g1 && (pos->castle & wk) &&
+                    !(occupancy & ((1ULL << f1) | (1ULL << g1)))) ||
+                   (source_square == e1 && target_square == c1 && (pos->castle & wq) &&
+                    !(occupancy & ((1ULL << b1) | (1ULL << c1) | (1ULL << d1))));
+        return (source_square == e8 && target_square == g8 && (pos->castle & bk) &&
+                !(occupancy & ((1ULL << f8) | (1ULL << g8)))) ||
+               (source_square == e8 && target_square == c8 && (pos->castle & bq) &&
+                !(occupancy & ((1ULL << b8) | (1ULL << c8) | (1ULL << d8))));
+    }
+
+    if (piece != base)
+    {
+        if (promoted_piece || double_push || enpass || capture != (get_bit(enemy, target_square) ? 1 : 0))
+            return 0;
+
+        U64 attacks;
+        if (piece == base + 1)
+            attacks = knight_attacks[source_square];
+        else if (piece == base + 2)
+            attacks = get_bishop_attacks_magic(source_square, occupancy);
+        else if (piece == base + 3)
+            attacks = get_rook_attacks_magic(source_square, occupancy);
+        else if (piece == base + 4)
+            attacks = get_bishop_attacks_magic(source_square, occupancy) | get_rook_attacks_magic(source_square, occupancy);
+        else
+            attacks = king_attacks[source_square];
+        return get_bit(attacks, target_square) ? 1 : 0;
+    }
+
+    // ===== PAWN MOVES =====
+    int last_rank = (us == white) ? (target_square < 8) : (target_square >= 56);
+    if (last_rank ? (promoted_piece < base + 1 || promoted_piece > base + 4) : promoted_piece != 0)
+        return 0;
+
+    if (enpass)
+        return capture && !double_push && target_square == pos->en_passant &&
+               get_bit(pawn_attacks[us][source_square], target_square);
 
-    // Handle captures
     if (capture)
+        return !double_push && get_bit(enemy, target_square) &&
+               get_bit(pawn_attacks[us][source_square], target_square);
+
+    int push = (us == white) ? -8 : 8;
+    U64 start_rank = (us == white) ? 0x00FF000000000000ULL : 0x000000000000FF00ULL;
+    if (get_bit(occupancy, (source_square + push)))
+        return 0;
+    if (double_push)
+        return get_bit(start_rank, source_square) && target_square == source_square + 2 * push &&
+               !get_bit(occupancy, target_square);
+    return target_square == source_square + push;
+}
+
+// Is the pseudo-legal 'move' legal? Uses the same checker and pin masks
+// as the generator, so the two always agree.
+int is_legal(const Position *pos, int move)
+{
+    int us = pos->side;
+    int them = us ^ 1;
+    int base = (us == white) ? P : p;
+    int source_square = get_move_source(move);
+    int target_square = get_move_target(move);
+    int king_square = get_ls1b_index(pos->bitboards[base + 5]);
+    U64 occupancy = pos->occupancies[both];
+    U64 enemy = pos->occupancies[them];
+
+    U64 checkers = attackers_to(pos, king_square, occupancy) & enemy;
+
+    // The king may not cross or land on an attacked square
+    if (get_move_castling(move))
+    {
+        int step = (target_square > source_square) ? 1 : -1;
+        return !checkers &&
+               !is_square_attacked(pos, source_square + step, them) &&
+               !is_square_attacked(pos, target_square, them);
+    }
+
+    // The king is taken off the board so it cannot hide behind itself
+    if (source_square == king_square)
+        return !(attackers_to(pos, target_square, occupancy ^ (1ULL << king_square)) & enemy);
+
+    if (get_move_enpassant(move))
+        return enpassant_is_legal(pos, source_square, target_square, king_square, checkers);
+
+    if (checkers & (checkers - 1))
+        return 0;
+    if (checkers &&
+        !get_bit((between_squares[king_square][get_ls1b_index(checkers)] | checkers), target_square))
+        return 0;
+
+    U64 pinned = blockers_for(pos, king_square, them) & pos->occupancies[us];
+    return !get_bit(pinned, source_square) || get_bit(line_through[king_square][source_square], target_square);
+}
+
+// Add a pawn move to 'target', expanding promotions by generator subset:
+// queen promotions count as captures, underpromotions as quiets
+static void add_pawn_move(moves *move_list, int type, int source_square, int target_square, int piece, int capture)
+{
+    int last_rank = (piece == P) ? (target_square <= h8) : (target_square >= a1);
+
+    if (last_rank)
     {
-        int start_piece = (side == white) ? p : P;
-        int end_piece = (side == white) ? k : K;
-        for (int bb_piece = start_piece; bb_piece <= end_piece; bb_piece++)
+        // Promotions are never part of the quiet checks
+        if (type == gen_quiet_checks)
+            return;
+
+        int queen = (piece == P) ? Q : q;
+        if (type != gen_quiets)
+            add_move(move_list, encode_move(source_square, target_square, piece, queen, capture, 0, 0, 0));
+        if (type != gen_captures)
         {
-            if (get_bit(bitboards[bb_piece], target_square))
-            {
-                pop_bit(bitboards[bb_piece], target_square);
-                hash_key ^= piece_keys[bb_piece][target_square];
-                break;
-            }
+            for (int promoted = queen - 1; promoted >= queen - 3; promoted--)
+                add_move(move_list, encode_move(source_square, target_square, piece, promoted, capture, 0, 0, 0));
         }
     }
+    else if (capture ? type != gen_quiets : type != gen_captures)
+    {
+        add_move(move_list, encode_move(source_square, target_square, piece, 0, capture, 0, 0, 0));
+    }
+}
 
-    // Handle promotions
-    if (promoted_piece)
+// add_pawn_move() for every square in 'targets', each reached from the
+// square 'offset' behind it
+static void add_pawn_moves(moves *move_list, int type, U64 targets, int offset, int piece, int capture)
+{
+    while (targets)
     {
-        pop_bit(bitboards[(side == white) ? P : p], target_square);
-        set_bit(bitboards[promoted_piece], target_square);
-        hash_key ^= piece_keys[(side == white) ? P : p][target_square];
-        hash_key ^= piece_keys[promoted_piece][target_square];
+        int target_square = get_ls1b_index(targets);
+        add_pawn_move(move_list, type, target_square - offset, target_square, piece, capture);
+        pop_ls1b(targets);
     }
+}
 
-    // Handle en passant capture
-    if (enpass)
+// King steps onto the squares in 'allowed'
+static void add_king_moves(moves *move_list, int king_square, int king, U64 allowed, U64 enemy)
+{
+    U64 attacks = king_attacks[king_square] & allowed;
+    while (attacks)
     {
-        if (side == white)
+        int target_square = get_ls1b_index(attacks);
+        int capture = get_bit(enemy, target_square) ? 1 : 0;
+        add_move(move_list, encode_move(king_square, target_square, king, 0, capture, 0, 0, 0));
+        pop_ls1b(attacks);
+    }
+}
+
+// Legal moves of one subset (gen_all, gen_captures, gen_quiets or
+// gen_quiet_checks). Checkers, pins and the squares the king may not step
+// on are worked out once, so no move has to be made to be rejected; in
+// double check only king moves are generated.
+static void generate_legal(const Position *pos, moves *move_list, int type)
+{
+    move_list->count = 0;
+
+    int us = pos->side;
+    int them = us ^ 1;
+    int base = (us == white) ? P : p;
+    int king_square = get_ls1b_index(pos->bitboards[base + 5]);
+    U64 own = pos->occupancies[us];
+    U64 enemy = pos->occupancies[them];
+    U64 occupancy = pos->occupancies[both];
+
+    // Destination squares of piece moves in this subset
+    U64 subset = (type == gen_captures) ? enemy : (type == gen_all) ? ~own : ~occupancy;
+
+    U64 checkers = attackers_to(pos, king_square, occupancy) & enemy;
+
+    // The king is taken off the board so it cannot hide behind itself
+    U64 danger = attacked_squares(pos, them, occupancy ^ (1ULL << king_square));
+    U64 attacks;
+
+    // For quiet checks each piece type may only go where it attacks the
+    // enemy king, unless it is moving off a line one of our sliders would
+    // then check along
+    U64 check_squares[6] = {~0ULL, ~0ULL, ~0ULL, ~0ULL, ~0ULL, ~0ULL};
+    U64 discoverers = 0ULL;
+    int their_king = get_ls1b_index(pos->bitboards[(them == white) ? K : k]);
+    if (type == gen_quiet_checks)
+    {
+        CheckInfo ci;
+        init_check_info(pos, &ci);
+        for (int i = 0; i < 6; i++)
+            check_squares[i] = ci.check_squares[i];
+        discoverers = ci.discoverers;
+    }
+
+#define discovery_squares(square) \
+    (get_bit(discoverers, square) ? ~line_through[their_king][square] : 0ULL)
+
+    if (checkers & (checkers - 1))
+    {
+        add_king_moves(move_list, king_square, base + 5,
+                       subset & ~danger & (check_squares[5] | discovery_squares(king_square)), enemy);
+        return;
+    }
+
+    // Out of check every other move must capture the checker or block
+    U64 target = ~own;
+    if (checkers)
+        target = between_squares[king_square][get_ls1b_index(checkers)] | checkers;
+
+    U64 pinned = blockers_for(pos, king_square, them) & own;
+
+    // ===== PAWN MOVES =====
+    // Whole-bitboard shifts for the pawns that move freely. Pinned pawns,
+    // and discovered-check candidates for quiet checks, go square by square.
+    int push = (us == white) ? -8 : 8;
+    U64 pawns = pos->bitboards[base];
+    U64 slow_pawns = pawns & (pinned | discoverers);
+    U64 free_pawns = pawns ^ slow_pawns;
+    U64 last_rank = (us == white) ? 0x00000000000000FFULL : 0xFF00000000000000ULL;
+    U64 third_rank = (us == white) ? 0x0000FF0000000000ULL : 0x0000000000FF0000ULL;
+    U64 pawn_targets = target & check_squares[0];
+
+    // Plain captures belong to gen_all and gen_captures; the others only
+    // take the underpromotions
+    U64 capture_targets = enemy;
+    if (type == gen_quiets || type == gen_quiet_checks)
+        capture_targets &= last_rank;
+
+    U64 single = ((us == white) ? (free_pawns >> 8) : (free_pawns << 8)) & ~occupancy;
+    if (type != gen_captures)
+    {
+        U64 double_push = ((us == white) ? ((single & third_rank) >> 8) : ((single & third_rank) << 8)) &
+                          ~occupancy & pawn_targets;
+        while (double_push)
         {
-            pop_bit(bitboards[p], target_square + 8);
-            hash_key ^= piece_keys[p][target_square + 8];
+            int target_square = get_ls1b_index(double_push);
+            add_move(move_list, encode_move(target_square - 2 * push, target_square, base, 0, 0, 1, 0, 0));
+            pop_ls1b(double_push);
         }
-        else
+        add_pawn_moves(move_list, type, single & pawn_targets & ~last_rank, push, base, 0);
+    }
+    add_pawn_moves(move_list, type, single & pawn_targets & last_rank, push, base, 0);
+
+    U64 toward_a = ((us == white) ? (free_pawns >> 9) : (free_pawns << 7)) & not_h_file;
+    U64 toward_h = ((us == white) ? (free_pawns >> 7) : (free_pawns << 9)) & not_a_file;
+    add_pawn_moves(move_list, type, toward_a & capture_targets & pawn_targets, (us == white) ? -9 : 7, base, 1);
+    add_pawn_moves(move_list, type, toward_h & capture_targets & pawn_targets, (us == white) ? -7 : 9, base, 1);
+
+    while (slow_pawns)
+    {
+        int source_square = get_ls1b_index(slow_pawns);
+        U64 allowed = target & (check_squares[0] | discovery_squares(source_square));
+        if (get_bit(pinned, source_square))
+            allowed &= line_through[king_square][source_square];
+
+        int target_square = source_square + push;
+        if (!get_bit(occupancy, target_square))
+        {
+            if (get_bit(allowed, target_square))
+                add_pawn_move(move_list, type, source_square, target_square, base, 0);
+
+            // The double push may block a check the single push does not
+            int double_square = target_square + push;
+            if (type != gen_captures && get_bit(third_rank, target_square) &&
+                !get_bit(occupancy, double_square) && get_bit(allowed, double_square))
+                add_move(move_list, encode_move(source_square, double_square, base, 0, 0, 1, 0, 0));
+        }
+
+        attacks = pawn_attacks[us][source_square] & capture_targets & allowed;
+        while (attacks)
         {
-            pop_bit(bitboards[P], target_square - 8);
-            hash_key ^= piece_keys[P][target_square - 8];
+            add_pawn_move(move_list, type, source_square, get_ls1b_index(attacks), base, 1);
+            pop_ls1b(attacks);
         }
+        pop_ls1b(slow_pawns);
     }
 
-    // Update en passant state
-    if (en_passant != no_sq)
-        hash_key ^= enpassant_keys[en_passant];
-    en_passant = no_sq;
+    // En passant takes two pawns off one rank, so each capturer (pinned or
+    // not) is checked against the king directly
+    if ((type == gen_all || type == gen_captures) && pos->en_passant != no_sq)
+    {
+        U64 capturers = pawn_attacks[them][pos->en_passant] & pawns;
+        while (capturers)
+        {
+            int source_square = get_ls1b_index(capturers);
+            if (enpassant_is_legal(pos, source_square, pos->en_passant, king_square, checkers))
+                add_move(move_list, encode_move(source_square, pos->en_passant, base, 0, 1, 0, 1, 0));
+            pop_ls1b(capturers);
+        }
+    }
 
-    if (double_push)
+    // ===== CASTLING MOVES =====
+    if (!checkers && (type == gen_all || type == gen_quiets))
     {
-        if (side == white)
+        if (us == white)
         {
-            en_passant = target_square + 8;
-            hash_key ^= enpassant_keys[target_square + 8];
+            if ((pos->castle & wk) && !(occupancy & ((1ULL << f1) | (1ULL << g1))) &&
+                !(danger & ((1ULL << f1) | (1ULL << g1))))
+                add_move(move_list, encode_move(e1, g1, K, 0, 0, 0, 0, 1));
+            if ((pos->castle & wq) && !(occupancy & ((1ULL << b1) | (1ULL << c1) | (1ULL << d1))) &&
+                !(danger & ((1ULL << c1) | (1ULL << d1))))
+                add_move(move_list, encode_move(e1, c1, K, 0, 0, 0, 0, 1));
         }
         else
         {
-            en_passant = target_square - 8;
-            hash_key ^= enpassant_keys[target_square - 8];
+            if ((pos->castle & bk) && !(occupancy & ((1ULL << f8) | (1ULL << g8))) &&
+                !(danger & ((1ULL << f8) | (1ULL << g8))))
+                add_move(move_list, encode_move(e8, g8, k, 0, 0, 0, 0, 1));
+            if ((pos->castle & bq) && !(occupancy & ((1ULL << b8) | (1ULL << c8) | (1ULL << d8))) &&
+                !(danger & ((1ULL << c8) | (1ULL << d8))))
+                add_move(move_list, encode_move(e8, c8, k, 0, 0, 0, 0, 1));
         }
     }
 
-    // Handle castling rook moves
-    if (castling)
+    // ===== PIECE MOVES (Knight, Bishop, Rook, Queen) =====
+    for (int piece = base + 1; piece <= base + 4; piece++)
     {
-        switch (target_square)
+        U64 bitboard = pos->bitboards[piece];
+        while (bitboard)
         {
-        case g1:
-            pop_bit(bitboards[R], h1);
-            set_bit(bitboards[R], f1);
-            hash_key ^= piece_keys[R][h1];
-            hash_key ^= piece_keys[R][f1];
-            break;
-        case c1:
-            pop_bit(bitboards[R], a1);
-            set_bit(bitboards[R], d1);
-            hash_key ^= piece_keys[R][a1];
-            hash_key ^= piece_keys[R][d1];
-            break;
-        case g8:
-            pop_bit(bitboards[r], h8);
-            set_bit(bitboards[r], f8);
-            hash_key ^= piece_keys[r][h8];
-            hash_key ^= piece_keys[r][f8];
-            break;
-        case c8:
-            pop_bit(bitboards[r], a8);
-            set_bit(bitboards[r], d8);
-            hash_key ^= piece_keys[r][a8];
-            hash_key ^= piece_keys[r][d8];
-            break;
+            int source_square = get_ls1b_index(bitboard);
+
+            if (piece == base + 1)
+                attacks = knight_attacks[source_square];
+            else if (piece == base + 2)
+                attacks = get_bishop_attacks_magic(source_square, occupancy);
+            else if (piece == base + 3)
+                attacks = get_rook_attacks_magic(source_square, occupancy);
+            else
+                attacks = get_bishop_attacks_magic(source_square, occupancy) | get_rook_attacks_magic(source_square, occupancy);
+
+            attacks &= target & subset & (check_squares[piece - base] | discovery_squares(source_square));
+            if (get_bit(pinned, source_square))
+                attacks &= line_through[king_square][source_square];
+
+            while (attacks)
+            {
+                int target_square = get_ls1b_index(attacks);
+                int capture = get_bit(enemy, target_square) ? 1 : 0;
+                add_move(move_list, encode_move(source_square, target_square, piece, 0, capture, 0, 0, 0));
+                pop_ls1b(attacks);
+            }
+            pop_ls1b(bitboard);
         }
     }
 
-    // Update castling rights
-    hash_key ^= castle_keys[castle];
-    castle &= castling_rights[source_square];
-    castle &= castling_rights[target_square];
-    hash_key ^= castle_keys[castle];
+    // ===== KING MOVES =====
+    add_king_moves(move_list, king_square, base + 5,
+                   subset & ~danger & (check_squares[5] | discovery_squares(king_square)), enemy);
 
-    // Update occupancies
-    for (int i = 0; i < 3; i++)
-        occupancies[i] = 0ULL;
-    for (int bb_piece = P; bb_piece <= K; bb_piece++)
-        occupancies[white] |= bitboards[bb_piece];
-    for (int bb_piece = p; bb_piece <= k; bb_piece++)
-        occupancies[black] |= bitboards[bb_piece];
-    occupancies[both] = occupancies[white] | occupancies[black];
+#undef discovery_squares
+}
 
-    // Change side
-    side ^= 1;
-    hash_key ^= side_key;
+void generate_legal_moves(const Position *pos, moves *move_list)
+{
+    generate_legal(pos, move_list, gen_all);
+}
 
-    // Legality check
-    if (is_square_attacked((side == white) ? get_ls1b_index(bitboards[k]) : get_ls1b_index(bitboards[K]), side))
-    {
-        take_back();
-        return 0;
-    }
-    return 1;
+void generate_captures(const Position *pos, moves *move_list)
+{
+    generate_legal(pos, move_list, gen_captures);
+}
+
+void generate_quiets(const Position *pos, moves *move_list)
+{
+    generate_legal(pos, move_list, gen_quiets);
+}
+
+void generate_quiet_checks(const Position *pos, moves *move_list)
+{
+    generate_legal(pos, move_list, gen_quiet_checks);
 }
 
 // ============================================ \\
 //           FEN PARSING                        \\
 // ============================================ \\
 
-void parse_fen(char *fen)
+void parse_fen(Position *pos, char *fen)
 {
     for (int i = 0; i < 12; i++)
-        bitboards[i] = 0ULL;
+        pos->bitboards[i] = 0ULL;
     for (int i = 0; i < 3; i++)
-        occupancies[i] = 0ULL;
-    side = 0;
-    en_passant = no_sq;
-    castle = 0;
+        pos->occupancies[i] = 0ULL;
+    memset(pos->piece_on, no_piece, sizeof(pos->piece_on));
+    pos->side = 0;
+    pos->en_passant = no_sq;
+    pos->castle = 0;
 
     int rank = 0, file = 0;
     while (rank < 8 && *fen && *fen != ' ')
@@ -501,7 +930,10 @@ void parse_fen(char *fen)
                 break;
             }
             if (piece != -1)
-                set_bit(bitboards[piece], square);
+            {
+                set_bit(pos->bitboards[piece], square);
+                pos->piece_on[square] = piece;
+            }
             file++;
             fen++;
         }
@@ -523,7 +955,7 @@ void parse_fen(char *fen)
     }
 
     fen++;
-    side = (*fen == 'w') ? white : black;
+    pos->side = (*fen == 'w') ? white : black;
     fen += 2;
 
     while (*fen != ' ')
@@ -531,16 +963,16 @@ void parse_fen(char *fen)
         switch (*fen)
         {
         case 'K':
-            castle |= wk;
+            pos->castle |= wk;
             break;
         case 'Q':
-            castle |= wq;
+            pos->castle |= wq;
             break;
         case 'k':
-            castle |= bk;
+            pos->castle |= bk;
             break;
         case 'q':
-            castle |= bq;
+            pos->castle |= bq;
             break;
         }
         fen++;
@@ -551,25 +983,26 @@ void parse_fen(char *fen)
     {
         int f = fen[0] - 'a';
         int r = 8 - (fen[1] - '0');
-        en_passant = r * 8 + f;
+        pos->en_passant = r * 8 + f;
     }
 
     for (int piece = P; piece <= K; piece++)
-        occupancies[white] |= bitboards[piece];
+        pos->occupancies[white] |= pos->bitboards[piece];
     for (int piece = p; piece <= k; piece++)
-        occupancies[black] |= bitboards[piece];
-    occupancies[both] = occupancies[white] | occupancies[black];
+        pos->occupancies[black] |= pos->bitboards[piece];
+    pos->occupancies[both] = pos->occupancies[white] | pos->occupancies[black];
 
-    hash_key = generate_hash_key();
+    pos->hash_key = generate_hash_key(pos);
+    nnue_reset(pos);
 }
 
-int parse_move(char *move_string)
+int parse_move(Position *pos, char *move_string)
 {
     if (!move_string || strlen(move_string) < 4)
         return 0;
 
     moves move_list[1];
-    generate_moves(move_list);
+    generate_legal_moves(pos, move_list);
 
     int source_file = move_string[0] - 'a';
     int source_rank = 8 - (move_string[1] - '0');
@@ -585,7 +1018,7 @@ int parse_move(char *move_string)
 
     for (int count = 0; count < move_list->count; count++)
     {
-        int move = move_list->moves[count];
+        int move = decode_with_position(pos, move_list->moves[count]);
         if (get_move_source(move) == source && get_move_target(move) == target)
         {
             int promoted = get_move_promoted(move);
@@ -609,31 +1042,31 @@ int parse_move(char *move_string)
     return 0;
 }
 
-void parse_position(char *command)
+void parse_position(Position *pos, char *command)
 {
     command += 9;
     char *current_char = command;
-    repetition_index = 0;
+    pos->repetition_index = 0;
 
     if (strncmp(command, "startpos", 8) == 0)
     {
-        parse_fen(start_position);
+        parse_fen(pos, start_position);
     }
     else
     {
         current_char = strstr(command, "fen");
         if (current_char == NULL)
         {
-            parse_fen(start_position);
+            parse_fen(pos, start_position);
         }
         else
         {
             current_char += 4;
-            parse_fen(current_char);
+            parse_fen(pos, current_char);
         }
     }
 
-    repetition_table[repetition_index] = hash_key;
+    pos->repetition_table[pos->repetition_index] = pos->hash_key;
 
     current_char = strstr(command, "moves");
     if (current_char != NULL)
@@ -641,12 +1074,14 @@ void parse_position(char *command)
         current_char += 6;
         while (*current_char)
         {
-            int move = parse_move(current_char);
+            int move = parse_move(pos, current_char);
             if (move == 0)
                 break;
-            make_move(move, all_moves);
-            repetition_index++;
-            repetition_table[repetition_index] = hash_key;
+            undo_info undo;
+            make_move(pos, move, all_moves, &undo);
+            nnue_reset(pos); // game moves are never taken back
+            pos->repetition_index++;
+            pos->repetition_table[pos->repetition_index] = pos->hash_key;
             while (*current_char && *current_char != ' ')
                 current_char++;
             current_char++;
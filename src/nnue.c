@@ -3,20 +3,37 @@
 //    Neural Network Evaluation Support         \\
 // ============================================ \\
 
+// mmap flags and fileno are hidden under strict -std=c11
+#define _DEFAULT_SOURCE
+
 #include "types.h"
+#include <stddef.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <math.h>
 
+extern int search_threads_active();
+
 // ============================================ \\
 //           NNUE CONSTANTS & STRUCTURES        \\
 // ============================================ \\
 
-#define NNUE_INPUT_SIZE 768   // 12 pieces * 64 squares
-#define NNUE_HIDDEN1_SIZE 256 // First hidden layer
-#define NNUE_HIDDEN2_SIZE 32  // Second hidden layer
-#define NNUE_OUTPUT_SIZE 1    // Single evaluation output
-#define NNUE_SCALE 400        // Scale factor for final output
+// Architecture: (6144 -> 128) x 2 -> 32 -> 1. Both sides' first layers
+// share the input weights; the side to move's comes first in the 256 inputs
+// of the second layer and the output is from its point of view.
+#define NNUE_L2_INPUT_SIZE (2 * NNUE_HIDDEN1_SIZE) // Both sides' first layers
+#define NNUE_HIDDEN2_SIZE 32                       // Second hidden layer
+#define NNUE_OUTPUT_SIZE 1                         // Single evaluation output
+#define NNUE_SCALE 400                             // Scale factor for final output
+
+// Quantization: activations are uint8 in 0..NNUE_ACT_MAX standing for
+// 0..1. The first layer runs in int16 with 1.0 at NNUE_FT_SCALE, so its
+// clipped ReLU is a clamp and a shift. The two small layers use int8
+// weights scaled by a power of two picked per net, and int32 sums.
+#define NNUE_ACT_MAX 127
+#define NNUE_FT_SHIFT 3
+#define NNUE_FT_SCALE (NNUE_ACT_MAX << NNUE_FT_SHIFT)
+#define NNUE_MAX_WEIGHT_SHIFT 12
 
 // Compile with -DUSE_NNUE to enable
 #ifdef USE_NNUE
@@ -26,54 +43,335 @@
 #endif
 
 // NNUE Weight structure
+// Float weights as training produces them and raw float nets hold;
+// inference uses the quantized copy made from them by nnue_quantize()
 typedef struct
 {
     float input_weights[NNUE_INPUT_SIZE][NNUE_HIDDEN1_SIZE];
     float hidden1_bias[NNUE_HIDDEN1_SIZE];
-    float hidden1_weights[NNUE_HIDDEN1_SIZE][NNUE_HIDDEN2_SIZE];
+    float hidden1_weights[NNUE_L2_INPUT_SIZE][NNUE_HIDDEN2_SIZE];
     float hidden2_bias[NNUE_HIDDEN2_SIZE];
     float hidden2_weights[NNUE_HIDDEN2_SIZE];
     float output_bias;
-    int loaded;
 } NNUEWeights;
 
 NNUEWeights nnue_weights = {0};
 
-// NNUE Accumulator for incremental updates
+#define NNUE_FLOAT_FILE_SIZE ((long)sizeof(NNUEWeights))
+
+// Quantized weights. hidden1_weights is transposed to one row per output
+// so the SIMD kernels read contiguous int8 dot products. This is also the
+// body of a net file, byte for byte (little-endian, every array on a
+// 64-byte boundary); training/convert_nnue.py writes the same layout.
 typedef struct
 {
-    float hidden1[NNUE_HIDDEN1_SIZE];
-    int valid;
-} NNUEAccumulator;
+    _Alignas(64) int16_t input_weights[NNUE_INPUT_SIZE][NNUE_HIDDEN1_SIZE];
+    _Alignas(64) int16_t hidden1_bias[NNUE_HIDDEN1_SIZE];
+    _Alignas(64) int8_t hidden1_weights[NNUE_HIDDEN2_SIZE][NNUE_L2_INPUT_SIZE];
+    _Alignas(64) int32_t hidden2_bias[NNUE_HIDDEN2_SIZE];
+    _Alignas(64) int32_t hidden2_weights[NNUE_HIDDEN2_SIZE]; // int8 range
+    _Alignas(64) int32_t output_bias;
+} NNUEQuantized;
+
+_Static_assert(offsetof(NNUEQuantized, hidden1_bias) == 2 * NNUE_INPUT_SIZE * NNUE_HIDDEN1_SIZE &&
+                   offsetof(NNUEQuantized, output_bias) % 64 == 0 && sizeof(NNUEQuantized) % 64 == 0,
+               "net file body must be the packed, 64-byte aligned arrays");
+
+// Net file: a page-sized header, then the NNUEQuantized body. The body is
+// mapped straight from the file, read-only and shared, so every engine
+// process running the same net uses one copy in the page cache.
+#define NNUE_FILE_MAGIC "FE64NNUE"
+#define NNUE_FILE_VERSION 1
+#define NNUE_FILE_HEADER_SIZE 4096
 
-NNUEAccumulator nnue_accum[2]; // [side]
+typedef struct
+{
+    char magic[8];
+    uint32_t version;
+    uint32_t checksum;     // CRC-32 of the body
+    uint64_t weights_size; // bytes in the body
+    // Architecture
+    uint32_t input_size;
+    uint32_t hidden1_size;
+    uint32_t hidden2_size;
+    uint32_t king_buckets;
+    uint8_t king_bucket_table[64];
+    // Quantization
+    uint32_t ft_scale;      // first layer value of 1.0
+    uint32_t act_max;       // activation value of 1.0
+    uint32_t hidden1_shift; // hidden1_weights = w << hidden1_shift
+    uint32_t hidden2_shift; // hidden2_weights = w << hidden2_shift
+    uint32_t output_scale;  // centipawns per unit of output
+    char description[64];
+} NNUEFileHeader;
+
+_Static_assert(offsetof(NNUEFileHeader, description) == 124 && sizeof(NNUEFileHeader) <= NNUE_FILE_HEADER_SIZE,
+               "net file header must stay packed");
+
+// The net in use: nnue_quant when built from float weights, otherwise
+// the body of a loaded net file in nnue_memory
+static NNUEQuantized nnue_quant;
+static const NNUEQuantized *nnue_net = &nnue_quant;
+static int nnue_hidden1_shift;
+static int nnue_hidden2_shift;
+static char nnue_description[64];
+static int nnue_loaded = 0;
+
+static void *nnue_memory = NULL;
+static size_t nnue_memory_size = 0;
+static int nnue_memory_mapped = 0;
+
+// King bucket by square, from white's side (rank 1 at the bottom). Each
+// back-rank square gets its own bucket, the rest of the board is coarser;
+// files e-h are mirrored onto d-a.
+const uint8_t nnue_king_buckets[64] = {
+    7, 7, 7, 7, 7, 7, 7, 7,
+    7, 7, 7, 7, 7, 7, 7, 7,
+    7, 7, 7, 7, 7, 7, 7, 7,
+    7, 7, 7, 7, 7, 7, 7, 7,
+    6, 6, 6, 6, 6, 6, 6, 6,
+    6, 6, 6, 6, 6, 6, 6, 6,
+    4, 4, 5, 5, 5, 5, 4, 4,
+    0, 1, 2, 3, 3, 2, 1, 0};
 
 // ============================================ \\
-//           ACTIVATION FUNCTIONS               \\
+//           QUANTIZATION                       \\
 // ============================================ \\
 
-// ReLU activation function
-static inline float relu(float x)
+static int32_t quantize(float x, float scale, int32_t limit)
 {
-    return x > 0 ? x : 0;
+    float q = roundf(x * scale);
+    if (q > limit)
+        return limit;
+    if (q < -limit)
+        return -limit;
+    return (int32_t)q;
 }
 
-// Clipped ReLU (CReLU) - common in NNUE
-static inline float crelu(float x)
+// Largest power of two (up to 2^NNUE_MAX_WEIGHT_SHIFT) that keeps every
+// weight in +-127
+static int weight_shift(const float *weights, int count)
 {
-    if (x < 0)
-        return 0;
-    if (x > 1)
+    float max = 0;
+    for (int i = 0; i < count; i++)
+        if (fabsf(weights[i]) > max)
+            max = fabsf(weights[i]);
+
+    int shift = 0;
+    while (shift < NNUE_MAX_WEIGHT_SHIFT && max * (1 << (shift + 1)) <= 127.0f)
+        shift++;
+    return shift;
+}
+
+static void nnue_release_memory()
+{
+    if (!nnue_memory)
+        return;
+#ifndef _WIN32
+    if (nnue_memory_mapped)
+        munmap(nnue_memory, nnue_memory_size);
+    else
+#endif
+        free(nnue_memory);
+    nnue_memory = NULL;
+    nnue_memory_size = 0;
+    nnue_memory_mapped = 0;
+}
+
+// Switching nets releases the old one, which helper threads may still be
+// reading, so it is refused while a search is running
+static int nnue_can_switch()
+{
+    if (!search_threads_active())
         return 1;
-    return x;
+    printf("info string Cannot change the NNUE during a search\n");
+    return 0;
+}
+
+// Rebuild nnue_quant from nnue_weights and switch to it. Weights are
+// clamped to +-127 so the u8 * i8 pair sums in the SIMD kernels (at most
+// 2 * 127 * 127) never saturate, which keeps them bit-identical to the
+// scalar code. Half a step is added to the biases in front of each
+// activation shift so the shift rounds to nearest instead of down.
+static void nnue_quantize()
+{
+    for (int i = 0; i < NNUE_INPUT_SIZE; i++)
+        for (int j = 0; j < NNUE_HIDDEN1_SIZE; j++)
+            nnue_quant.input_weights[i][j] = quantize(nnue_weights.input_weights[i][j], NNUE_FT_SCALE, INT16_MAX);
+    for (int j = 0; j < NNUE_HIDDEN1_SIZE; j++)
+        nnue_quant.hidden1_bias[j] = quantize(nnue_weights.hidden1_bias[j], NNUE_FT_SCALE, INT16_MAX - 4) +
+                                     (1 << (NNUE_FT_SHIFT - 1));
+
+    int shift = weight_shift(&nnue_weights.hidden1_weights[0][0], NNUE_L2_INPUT_SIZE * NNUE_HIDDEN2_SIZE);
+    nnue_hidden1_shift = shift;
+    for (int i = 0; i < NNUE_L2_INPUT_SIZE; i++)
+        for (int j = 0; j < NNUE_HIDDEN2_SIZE; j++)
+            nnue_quant.hidden1_weights[j][i] = quantize(nnue_weights.hidden1_weights[i][j], 1 << shift, 127);
+    for (int j = 0; j < NNUE_HIDDEN2_SIZE; j++)
+        nnue_quant.hidden2_bias[j] = quantize(nnue_weights.hidden2_bias[j], NNUE_ACT_MAX << shift, 1 << 30) +
+                                     (shift ? 1 << (shift - 1) : 0);
+
+    shift = weight_shift(nnue_weights.hidden2_weights, NNUE_HIDDEN2_SIZE);
+    nnue_hidden2_shift = shift;
+    for (int j = 0; j < NNUE_HIDDEN2_SIZE; j++)
+        nnue_quant.hidden2_weights[j] = quantize(nnue_weights.hidden2_weights[j], 1 << shift, 127);
+    nnue_quant.output_bias = quantize(nnue_weights.output_bias, NNUE_ACT_MAX << shift, 1 << 30);
+
+    nnue_release_memory();
+    nnue_net = &nnue_quant;
+    nnue_loaded = 1;
 }
 
 // ============================================ \\
 //           FILE I/O FUNCTIONS                 \\
 // ============================================ \\
 
+// CRC-32 (IEEE, as zlib.crc32 computes it)
+static uint32_t nnue_crc32(const uint8_t *data, size_t size)
+{
+    static uint32_t table[256];
+    if (!table[1])
+        for (uint32_t i = 0; i < 256; i++)
+        {
+            uint32_t c = i;
+            for (int bit = 0; bit < 8; bit++)
+                c = c & 1 ? 0xEDB88320u ^ (c >> 1) : c >> 1;
+            table[i] = c;
+        }
+
+    uint32_t crc = 0xFFFFFFFFu;
+    for (size_t i = 0; i < size; i++)
+        crc = table[(crc ^ data[i]) & 255] ^ (crc >> 8);
+    return ~crc;
+}
+
+// Header of a net file for this architecture, weights not filled in
+static void nnue_file_header(NNUEFileHeader *header)
+{
+    memset(header, 0, sizeof(*header));
+    memcpy(header->magic, NNUE_FILE_MAGIC, sizeof(header->magic));
+    header->version = NNUE_FILE_VERSION;
+    header->weights_size = sizeof(NNUEQuantized);
+    header->input_size = NNUE_INPUT_SIZE;
+    header->hidden1_size = NNUE_HIDDEN1_SIZE;
+    header->hidden2_size = NNUE_HIDDEN2_SIZE;
+    header->king_buckets = NNUE_KING_BUCKETS;
+    memcpy(header->king_bucket_table, nnue_king_buckets, 64);
+    header->ft_scale = NNUE_FT_SCALE;
+    header->act_max = NNUE_ACT_MAX;
+    header->output_scale = NNUE_SCALE;
+}
+
+// Net file: check the header against this build, map the body and verify
+// its checksum. The net in use is only replaced once all of that passed.
+static int load_nnue_net(FILE *f, const char *filename, long size, const NNUEFileHeader *header)
+{
+    NNUEFileHeader expected;
+    nnue_file_header(&expected);
+
+    if (header->version != NNUE_FILE_VERSION)
+    {
+        printf("info string %s is NNUE file version %u, expected %u\n", filename, header->version, NNUE_FILE_VERSION);
+        return 0;
+    }
+    if (header->weights_size != expected.weights_size ||
+        header->input_size != expected.input_size ||
+        header->hidden1_size != expected.hidden1_size ||
+        header->hidden2_size != expected.hidden2_size ||
+        header->king_buckets != expected.king_buckets ||
+        memcmp(header->king_bucket_table, expected.king_bucket_table, 64) != 0)
+    {
+        printf("info string %s is a net for another architecture (%u x %u -> %u, %u king buckets)\n", filename,
+               header->input_size, header->hidden1_size, header->hidden2_size, header->king_buckets);
+        return 0;
+    }
+    if (header->ft_scale != expected.ft_scale || header->act_max != expected.act_max ||
+        header->output_scale != expected.output_scale ||
+        header->hidden1_shift > NNUE_MAX_WEIGHT_SHIFT || header->hidden2_shift > NNUE_MAX_WEIGHT_SHIFT)
+    {
+        printf("info string %s uses an unsupported quantization\n", filename);
+        return 0;
+    }
+    if (size != NNUE_FILE_HEADER_SIZE + (long)header->weights_size)
+    {
+        printf("info string %s has %ld bytes, expected %ld\n", filename, size,
+               NNUE_FILE_HEADER_SIZE + (long)header->weights_size);
+        return 0;
+    }
+
+    void *memory;
+    const NNUEQuantized *net;
+    int mapped = 0;
+#ifndef _WIN32
+    // The whole file, so the body sits 4 KB into a page-aligned mapping
+    // whatever the system page size
+    memory = mmap(NULL, (size_t)size, PROT_READ, MAP_SHARED, fileno(f), 0);
+    if (memory != MAP_FAILED)
+    {
+        mapped = 1;
+        net = (const NNUEQuantized *)((const char *)memory + NNUE_FILE_HEADER_SIZE);
+    }
+    else
+#endif
+    {
+        // No file mapping: read the body into memory of its own
+        memory = malloc(sizeof(NNUEQuantized) + 63);
+        net = (const NNUEQuantized *)(((uintptr_t)memory + 63) & ~(uintptr_t)63);
+        if (!memory || fseek(f, NNUE_FILE_HEADER_SIZE, SEEK_SET) != 0 ||
+            fread((void *)net, sizeof(NNUEQuantized), 1, f) != 1)
+        {
+            printf("info string Failed to read %s\n", filename);
+            free(memory);
+            return 0;
+        }
+    }
+
+    if (nnue_crc32((const uint8_t *)net, sizeof(NNUEQuantized)) != header->checksum)
+    {
+        printf("info string %s is corrupt (checksum mismatch)\n", filename);
+#ifndef _WIN32
+        if (mapped)
+            munmap(memory, (size_t)size);
+        else
+#endif
+            free(memory);
+        return 0;
+    }
+
+    nnue_release_memory();
+    nnue_memory = memory;
+    nnue_memory_size = (size_t)size;
+    nnue_memory_mapped = mapped;
+    nnue_net = net;
+    nnue_hidden1_shift = header->hidden1_shift;
+    nnue_hidden2_shift = header->hidden2_shift;
+    memcpy(nnue_description, header->description, sizeof(nnue_description));
+    nnue_description[sizeof(nnue_description) - 1] = '\0';
+    nnue_loaded = 1;
+    return 1;
+}
+
+// Raw float net, as the trainers write it: no header, just the arrays
+// of NNUEWeights in order. Quantized here on every load.
+static int load_nnue_float(FILE *f, const char *filename)
+{
+    if (fread(&nnue_weights, sizeof(nnue_weights), 1, f) != 1)
+    {
+        printf("info string Failed to read %s\n", filename);
+        return 0;
+    }
+
+    nnue_quantize();
+    const char *base = strrchr(filename, '/');
+    snprintf(nnue_description, sizeof(nnue_description), "converted from %s", base ? base + 1 : filename);
+    return 1;
+}
+
 int load_nnue(const char *filename)
 {
+    if (!nnue_can_switch())
+        return 0;
+
     FILE *f = fopen(filename, "rb");
     if (!f)
     {
@@ -81,48 +379,84 @@ int load_nnue(const char *filename)
         return 0;
     }
 
-    size_t read = 0;
-    read += fread(nnue_weights.input_weights, sizeof(float), NNUE_INPUT_SIZE * NNUE_HIDDEN1_SIZE, f);
-    read += fread(nnue_weights.hidden1_bias, sizeof(float), NNUE_HIDDEN1_SIZE, f);
-    read += fread(nnue_weights.hidden1_weights, sizeof(float), NNUE_HIDDEN1_SIZE * NNUE_HIDDEN2_SIZE, f);
-    read += fread(nnue_weights.hidden2_bias, sizeof(float), NNUE_HIDDEN2_SIZE, f);
-    read += fread(nnue_weights.hidden2_weights, sizeof(float), NNUE_HIDDEN2_SIZE, f);
-    read += fread(&nnue_weights.output_bias, sizeof(float), 1, f);
+    fseek(f, 0, SEEK_END);
+    long size = ftell(f);
+    fseek(f, 0, SEEK_SET);
 
+    NNUEFileHeader header;
+    int ok;
+    if (size >= NNUE_FILE_HEADER_SIZE && fread(&header, sizeof(header), 1, f) == 1 &&
+        memcmp(header.magic, NNUE_FILE_MAGIC, sizeof(header.magic)) == 0)
+    {
+        ok = load_nnue_net(f, filename, size, &header);
+    }
+    else if (size == NNUE_FLOAT_FILE_SIZE)
+    {
+        fseek(f, 0, SEEK_SET);
+        ok = load_nnue_float(f, filename);
+        if (ok)
+            printf("info string %s is a raw float net; \"savennue\" or training/convert_nnue.py "
+                   "writes it as a net file\n",
+                   filename);
+    }
+    else
+    {
+        printf("info string %s is not an NNUE file (%ld bytes)\n", filename, size);
+        ok = 0;
+    }
     fclose(f);
 
-    nnue_weights.loaded = 1;
-    printf("info string NNUE loaded successfully (%zu parameters)\n", read);
-    return 1;
+    if (ok)
+        printf("info string NNUE loaded from %s: %s (%zu KB %s)\n", filename, nnue_description,
+               sizeof(NNUEQuantized) >> 10, nnue_memory_mapped ? "mapped" : "in memory");
+    return ok;
 }
 
+// Write the net in use as a net file
 int save_nnue(const char *filename)
 {
+    if (!nnue_loaded)
+    {
+        printf("info string No NNUE to save\n");
+        return 0;
+    }
+
     FILE *f = fopen(filename, "wb");
     if (!f)
+    {
+        printf("info string Cannot open %s for writing\n", filename);
         return 0;
+    }
 
-    fwrite(nnue_weights.input_weights, sizeof(float), NNUE_INPUT_SIZE * NNUE_HIDDEN1_SIZE, f);
-    fwrite(nnue_weights.hidden1_bias, sizeof(float), NNUE_HIDDEN1_SIZE, f);
-    fwrite(nnue_weights.hidden1_weights, sizeof(float), NNUE_HIDDEN1_SIZE * NNUE_HIDDEN2_SIZE, f);
-    fwrite(nnue_weights.hidden2_bias, sizeof(float), NNUE_HIDDEN2_SIZE, f);
-    fwrite(nnue_weights.hidden2_weights, sizeof(float), NNUE_HIDDEN2_SIZE, f);
-    fwrite(&nnue_weights.output_bias, sizeof(float), 1, f);
-
-    fclose(f);
-    return 1;
+    char header_page[NNUE_FILE_HEADER_SIZE] = {0};
+    NNUEFileHeader *header = (NNUEFileHeader *)header_page;
+    nnue_file_header(header);
+    header->checksum = nnue_crc32((const uint8_t *)nnue_net, sizeof(NNUEQuantized));
+    header->hidden1_shift = nnue_hidden1_shift;
+    header->hidden2_shift = nnue_hidden2_shift;
+    memcpy(header->description, nnue_description, sizeof(header->description));
+
+    int ok = fwrite(header_page, NNUE_FILE_HEADER_SIZE, 1, f) == 1 &&
+             fwrite(nnue_net, sizeof(NNUEQuantized), 1, f) == 1;
+    if (fclose(f) != 0)
+        ok = 0;
+    printf("info string NNUE %s %s\n", ok ? "saved to" : "failed to save to", filename);
+    return ok;
 }
 
 // ============================================ \\
 //           INITIALIZATION                     \\
 // ============================================ \\
 
-void init_nnue_random()
+int init_nnue_random()
 {
+    if (!nnue_can_switch())
+        return 0;
+
     srand(42); // Fixed seed for reproducibility
 
     float scale1 = sqrtf(2.0f / NNUE_INPUT_SIZE);
-    float scale2 = sqrtf(2.0f / NNUE_HIDDEN1_SIZE);
+    float scale2 = sqrtf(2.0f / NNUE_L2_INPUT_SIZE);
     float scale3 = sqrtf(2.0f / NNUE_HIDDEN2_SIZE);
 
     for (int i = 0; i < NNUE_INPUT_SIZE; i++)
@@ -130,11 +464,11 @@ void init_nnue_random()
             nnue_weights.input_weights[i][j] = ((float)rand() / RAND_MAX - 0.5f) * scale1;
 
     for (int i = 0; i < NNUE_HIDDEN1_SIZE; i++)
-    {
         nnue_weights.hidden1_bias[i] = 0;
+
+    for (int i = 0; i < NNUE_L2_INPUT_SIZE; i++)
         for (int j = 0; j < NNUE_HIDDEN2_SIZE; j++)
             nnue_weights.hidden1_weights[i][j] = ((float)rand() / RAND_MAX - 0.5f) * scale2;
-    }
 
     for (int i = 0; i < NNUE_HIDDEN2_SIZE; i++)
     {
@@ -143,9 +477,239 @@ void init_nnue_random()
     }
 
     nnue_weights.output_bias = 0;
-    nnue_weights.loaded = 1;
+    nnue_quantize();
+    snprintf(nnue_description, sizeof(nnue_description), "random weights (seed 42)");
+    return 1;
 }
 
+// ============================================ \\
+//           INFERENCE KERNELS                  \\
+// ============================================ \\
+
+// Three per-architecture steps, each with a scalar reference version:
+//   apply    - dst = src + input rows in 'add' - rows in 'sub' (int16,
+//              wrapping like the SIMD adds)
+//   activate - clipped ReLU of one side's accumulator into uint8 0..127
+//   affine   - the 256 -> 32 int8 layer, raw int32 dot products
+// All arithmetic is exact integer math, so every version gives the same
+// bits. The widest set the compiler targets is used by evaluate_nnue().
+
+static void apply_scalar(int16_t *dst, const int16_t *src, const int *add, int num_add, const int *sub, int num_sub)
+{
+    for (int i = 0; i < NNUE_HIDDEN1_SIZE; i++)
+    {
+        int16_t x = src[i];
+        for (int a = 0; a < num_add; a++)
+            x += nnue_net->input_weights[add[a]][i];
+        for (int s = 0; s < num_sub; s++)
+            x -= nnue_net->input_weights[sub[s]][i];
+        dst[i] = x;
+    }
+}
+
+static void activate_scalar(const int16_t *acc, uint8_t *out)
+{
+    for (int i = 0; i < NNUE_HIDDEN1_SIZE; i++)
+    {
+        int x = acc[i];
+        if (x < 0)
+            x = 0;
+        if (x > NNUE_FT_SCALE)
+            x = NNUE_FT_SCALE;
+        out[i] = x >> NNUE_FT_SHIFT;
+    }
+}
+
+static void affine_scalar(const uint8_t *in, int32_t *out)
+{
+    for (int o = 0; o < NNUE_HIDDEN2_SIZE; o++)
+    {
+        int32_t sum = 0;
+        for (int i = 0; i < NNUE_L2_INPUT_SIZE; i++)
+            sum += in[i] * nnue_net->hidden1_weights[o][i];
+        out[o] = sum;
+    }
+}
+
+#if defined(__SSE4_1__) || defined(__AVX2__)
+#include <immintrin.h>
+#endif
+
+#ifdef __SSE4_1__
+// The whole accumulator half stays in registers while the rows stream by
+#define SSE_CHUNKS (NNUE_HIDDEN1_SIZE / 8)
+
+static void apply_sse41(int16_t *dst, const int16_t *src, const int *add, int num_add, const int *sub, int num_sub)
+{
+    __m128i x[SSE_CHUNKS];
+    for (int c = 0; c < SSE_CHUNKS; c++)
+        x[c] = _mm_load_si128((const __m128i *)src + c);
+    for (int a = 0; a < num_add; a++)
+    {
+        const __m128i *row = (const __m128i *)nnue_net->input_weights[add[a]];
+        for (int c = 0; c < SSE_CHUNKS; c++)
+            x[c] = _mm_add_epi16(x[c], _mm_load_si128(row + c));
+    }
+    for (int s = 0; s < num_sub; s++)
+    {
+        const __m128i *row = (const __m128i *)nnue_net->input_weights[sub[s]];
+        for (int c = 0; c < SSE_CHUNKS; c++)
+            x[c] = _mm_sub_epi16(x[c], _mm_load_si128(row + c));
+    }
+    for (int c = 0; c < SSE_CHUNKS; c++)
+        _mm_store_si128((__m128i *)dst + c, x[c]);
+}
+
+static void activate_sse41(const int16_t *acc, uint8_t *out)
+{
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i max = _mm_set1_epi16(NNUE_FT_SCALE);
+    for (int i = 0; i < NNUE_HIDDEN1_SIZE; i += 16)
+    {
+        __m128i a = _mm_load_si128((const __m128i *)(acc + i));
+        __m128i b = _mm_load_si128((const __m128i *)(acc + i + 8));
+        a = _mm_srai_epi16(_mm_min_epi16(_mm_max_epi16(a, zero), max), NNUE_FT_SHIFT);
+        b = _mm_srai_epi16(_mm_min_epi16(_mm_max_epi16(b, zero), max), NNUE_FT_SHIFT);
+        _mm_store_si128((__m128i *)(out + i), _mm_packus_epi16(a, b));
+    }
+}
+
+// Four int32 partial sums of one output row
+static inline __m128i dot_sse41(const uint8_t *in, const int8_t *weights)
+{
+    const __m128i ones = _mm_set1_epi16(1);
+    __m128i sum = _mm_setzero_si128();
+    for (int i = 0; i < NNUE_L2_INPUT_SIZE; i += 16)
+    {
+        __m128i product = _mm_maddubs_epi16(_mm_load_si128((const __m128i *)(in + i)),
+                                            _mm_load_si128((const __m128i *)(weights + i)));
+        sum = _mm_add_epi32(sum, _mm_madd_epi16(product, ones));
+    }
+    return sum;
+}
+
+static void affine_sse41(const uint8_t *in, int32_t *out)
+{
+    for (int o = 0; o < NNUE_HIDDEN2_SIZE; o += 4)
+    {
+        __m128i s0 = dot_sse41(in, nnue_net->hidden1_weights[o]);
+        __m128i s1 = dot_sse41(in, nnue_net->hidden1_weights[o + 1]);
+        __m128i s2 = dot_sse41(in, nnue_net->hidden1_weights[o + 2]);
+        __m128i s3 = dot_sse41(in, nnue_net->hidden1_weights[o + 3]);
+        __m128i sums = _mm_hadd_epi32(_mm_hadd_epi32(s0, s1), _mm_hadd_epi32(s2, s3));
+        _mm_storeu_si128((__m128i *)(out + o), sums);
+    }
+}
+#endif
+
+#ifdef __AVX2__
+#define AVX2_CHUNKS (NNUE_HIDDEN1_SIZE / 16)
+
+static void apply_avx2(int16_t *dst, const int16_t *src, const int *add, int num_add, const int *sub, int num_sub)
+{
+    __m256i x[AVX2_CHUNKS];
+    for (int c = 0; c < AVX2_CHUNKS; c++)
+        x[c] = _mm256_load_si256((const __m256i *)src + c);
+    for (int a = 0; a < num_add; a++)
+    {
+        const __m256i *row = (const __m256i *)nnue_net->input_weights[add[a]];
+        for (int c = 0; c < AVX2_CHUNKS; c++)
+            x[c] = _mm256_add_epi16(x[c], _mm256_load_si256(row + c));
+    }
+    for (int s = 0; s < num_sub; s++)
+    {
+        const __m256i *row = (const __m256i *)nnue_net->input_weights[sub[s]];
+        for (int c = 0; c < AVX2_CHUNKS; c++)
+            x[c] = _mm256_sub_epi16(x[c], _mm256_load_si256(row + c));
+    }
+    for (int c = 0; c < AVX2_CHUNKS; c++)
+        _mm256_store_si256((__m256i *)dst + c, x[c]);
+}
+
+static void activate_avx2(const int16_t *acc, uint8_t *out)
+{
+    const __m256i zero = _mm256_setzero_si256();
+    const __m256i max = _mm256_set1_epi16(NNUE_FT_SCALE);
+    for (int i = 0; i < NNUE_HIDDEN1_SIZE; i += 32)
+    {
+        __m256i a = _mm256_load_si256((const __m256i *)(acc + i));
+        __m256i b = _mm256_load_si256((const __m256i *)(acc + i + 16));
+        a = _mm256_srai_epi16(_mm256_min_epi16(_mm256_max_epi16(a, zero), max), NNUE_FT_SHIFT);
+        b = _mm256_srai_epi16(_mm256_min_epi16(_mm256_max_epi16(b, zero), max), NNUE_FT_SHIFT);
+        // packus works within 128-bit lanes; put the quarters back in order
+        __m256i packed = _mm256_permute4x64_epi64(_mm256_packus_epi16(a, b), 0xD8);
+        _mm256_store_si256((__m256i *)(out + i), packed);
+    }
+}
+
+// Eight int32 partial sums of one output row
+static inline __m256i dot_avx2(const uint8_t *in, const int8_t *weights)
+{
+    const __m256i ones = _mm256_set1_epi16(1);
+    __m256i sum = _mm256_setzero_si256();
+    for (int i = 0; i < NNUE_L2_INPUT_SIZE; i += 32)
+    {
+        __m256i product = _mm256_maddubs_epi16(_mm256_load_si256((const __m256i *)(in + i)),
+                                               _mm256_load_si256((const __m256i *)(weights + i)));
+        sum = _mm256_add_epi32(sum, _mm256_madd_epi16(product, ones));
+    }
+    return sum;
+}
+
+static void affine_avx2(const uint8_t *in, int32_t *out)
+{
+    for (int o = 0; o < NNUE_HIDDEN2_SIZE; o += 8)
+    {
+        __m256i s[8];
+        for (int j = 0; j < 8; j++)
+            s[j] = dot_avx2(in, nnue_net->hidden1_weights[o + j]);
+
+        // Reduce eight rows at once: each 128-bit half ends up holding
+        // that half's sums of four rows, then the halves are added
+        __m256i a = _mm256_hadd_epi32(_mm256_hadd_epi32(s[0], s[1]), _mm256_hadd_epi32(s[2], s[3]));
+        __m256i b = _mm256_hadd_epi32(_mm256_hadd_epi32(s[4], s[5]), _mm256_hadd_epi32(s[6], s[7]));
+        __m256i sums = _mm256_add_epi32(_mm256_permute2x128_si256(a, b, 0x20),
+                                        _mm256_permute2x128_si256(a, b, 0x31));
+        _mm256_storeu_si256((__m256i *)(out + o), sums);
+    }
+}
+#endif
+
+#if defined(__AVX2__)
+#define nnue_apply apply_avx2
+#define nnue_activate activate_avx2
+#define nnue_affine affine_avx2
+#elif defined(__SSE4_1__)
+#define nnue_apply apply_sse41
+#define nnue_activate activate_sse41
+#define nnue_affine affine_sse41
+#else
+#define nnue_apply apply_scalar
+#define nnue_activate activate_scalar
+#define nnue_affine affine_scalar
+#endif
+
+// Every kernel set compiled into this binary, for "benchnnue"
+typedef struct
+{
+    const char *name;
+    void (*apply)(int16_t *, const int16_t *, const int *, int, const int *, int);
+    void (*activate)(const int16_t *, uint8_t *);
+    void (*affine)(const uint8_t *, int32_t *);
+} NNUEKernels;
+
+static const NNUEKernels nnue_kernels[] = {
+    {"scalar", apply_scalar, activate_scalar, affine_scalar},
+#ifdef __SSE4_1__
+    {"sse4.1", apply_sse41, activate_sse41, affine_sse41},
+#endif
+#ifdef __AVX2__
+    {"avx2", apply_avx2, activate_avx2, affine_avx2},
+#endif
+};
+
+#define NNUE_KERNEL_COUNT ((int)(sizeof(nnue_kernels) / sizeof(nnue_kernels[0])))
+
 // ============================================ \\
 //           NNUE EVALUATION                    \\
 // ============================================ \\
@@ -153,71 +717,192 @@ void init_nnue_random()
 // Check if NNUE weights are loaded
 int nnue_weights_loaded()
 {
-    return nnue_weights.loaded;
+    return nnue_loaded;
 }
 
-// NNUE Evaluation (OPTIMIZED: only iterate over active pieces)
-int evaluate_nnue()
+// Input feature of a board change (piece * 64 + square) for the side
+// whose king key is 'king_key': own pieces first, seen from its own side
+static inline int nnue_feature(int side, int king_key, int change)
 {
-    if (!nnue_weights.loaded)
-        return 0;
+    int piece = change >> 6;
+    int square = (change & 63) ^ (side == white ? 0 : 56) ^ ((king_key & 1) ? 7 : 0);
+    int relative = piece % 6 + (piece / 6 == side ? 0 : 6);
+    return (king_key >> 1) * 768 + relative * 64 + square;
+}
 
-    // Collect active piece indices (max 32 pieces)
-    int active_indices[32];
-    int num_active = 0;
+static inline int nnue_king_key_of(const Position *pos, int side)
+{
+    return nnue_king_key(side, get_ls1b_index(pos->bitboards[side == white ? K : k]));
+}
 
+// 'side's input features of the pieces on the board, one per occupied square
+static int nnue_features(const Position *pos, int side, int *features)
+{
+    int king_key = nnue_king_key_of(pos, side);
+    int count = 0;
     for (int piece = P; piece <= k; piece++)
     {
-        U64 bb = bitboards[piece];
+        U64 bb = pos->bitboards[piece];
         while (bb)
         {
-            int sq = get_ls1b_index(bb);
-            int idx = piece * 64 + sq;
-            if (idx < NNUE_INPUT_SIZE && num_active < 32)
-                active_indices[num_active++] = idx;
-            pop_bit(bb, sq);
+            features[count++] = nnue_feature(side, king_key, piece * 64 + get_ls1b_index(bb));
+            pop_ls1b(bb);
         }
     }
+    return count;
+}
 
-    // Forward pass - Layer 1 (OPTIMIZED: only add active weights)
-    float hidden1[NNUE_HIDDEN1_SIZE];
+_Static_assert(2 * NNUE_KING_KEYS <= 32, "nnue_cache_valid needs a bit per refresh cache entry");
 
-    // Start with biases
-    for (int i = 0; i < NNUE_HIDDEN1_SIZE; i++)
-        hidden1[i] = nnue_weights.hidden1_bias[i];
+// 'side's first layer for the board, from the refresh cache entry of its
+// king key: only the pieces that differ from the board cached there are
+// added and removed, and the entry is brought up to date on the way
+static void nnue_refresh(Position *pos, int side, int king_key, int16_t *hidden1)
+{
+    NNUECacheEntry *entry = &pos->nnue_cache[side][king_key];
+    uint32_t valid = 1u << (side * NNUE_KING_KEYS + king_key);
 
-    // Only add weights for active pieces
-    for (int a = 0; a < num_active; a++)
+    // A fresh entry holds the empty board
+    if (!(pos->nnue_cache_valid & valid))
     {
-        int j = active_indices[a];
-        for (int i = 0; i < NNUE_HIDDEN1_SIZE; i++)
-            hidden1[i] += nnue_weights.input_weights[j][i];
+        memcpy(entry->hidden1, nnue_net->hidden1_bias, sizeof(entry->hidden1));
+        memset(entry->bitboards, 0, sizeof(entry->bitboards));
+        pos->nnue_cache_valid |= valid;
     }
 
-    // Apply activation
-    for (int i = 0; i < NNUE_HIDDEN1_SIZE; i++)
-        hidden1[i] = crelu(hidden1[i]);
+    int add[64], sub[64];
+    int num_add = 0, num_sub = 0;
+    for (int piece = P; piece <= k; piece++)
+    {
+        U64 now = pos->bitboards[piece];
+        U64 on = now & ~entry->bitboards[piece];
+        U64 off = entry->bitboards[piece] & ~now;
+        while (on)
+        {
+            add[num_add++] = nnue_feature(side, king_key, piece * 64 + get_ls1b_index(on));
+            pop_ls1b(on);
+        }
+        while (off)
+        {
+            sub[num_sub++] = nnue_feature(side, king_key, piece * 64 + get_ls1b_index(off));
+            pop_ls1b(off);
+        }
+        entry->bitboards[piece] = now;
+    }
 
-    // Forward pass - Layer 2
-    float hidden2[NNUE_HIDDEN2_SIZE];
-    for (int i = 0; i < NNUE_HIDDEN2_SIZE; i++)
+    nnue_apply(entry->hidden1, entry->hidden1, add, num_add, sub, num_sub);
+    memcpy(hidden1, entry->hidden1, sizeof(entry->hidden1));
+}
+
+// Bring 'side's half of the top accumulator up to date: replay the board
+// changes from the nearest computed ancestor, 2-4 rows per ply. When that
+// side's king key changed on the way, or nothing below is computed, the
+// top is refreshed through the cache and the changes are undone back down
+// to that point so sibling nodes find a computed parent next time.
+static void nnue_update(Position *pos, int side)
+{
+    NNUEAccumulator *stack = pos->nnue_stack;
+    int top = pos->nnue_top;
+    int bit = 1 << side;
+
+    int ply = top;
+    while (ply > 0 && !(stack[ply].computed & bit) && !(stack[ply].refresh & bit))
+        ply--;
+
+    // Entries ply..top share the top's king key
+    int king_key = nnue_king_key_of(pos, side);
+    int add[2], sub[2];
+
+    if (stack[ply].computed & bit)
     {
-        hidden2[i] = nnue_weights.hidden2_bias[i];
-        for (int j = 0; j < NNUE_HIDDEN1_SIZE; j++)
+        for (ply++; ply <= top; ply++)
         {
-            hidden2[i] += hidden1[j] * nnue_weights.hidden1_weights[j][i];
+            NNUEAccumulator *acc = &stack[ply];
+            for (int i = 0; i < acc->num_added; i++)
+                add[i] = nnue_feature(side, king_key, acc->added[i]);
+            for (int i = 0; i < acc->num_removed; i++)
+                sub[i] = nnue_feature(side, king_key, acc->removed[i]);
+            nnue_apply(acc->hidden1[side], stack[ply - 1].hidden1[side], add, acc->num_added, sub, acc->num_removed);
+            acc->computed |= bit;
         }
-        hidden2[i] = crelu(hidden2[i]);
+        return;
     }
 
-    // Output layer
-    float output = nnue_weights.output_bias;
+    nnue_refresh(pos, side, king_key, stack[top].hidden1[side]);
+    stack[top].computed |= bit;
+
+    for (int p = top; p > ply; p--)
+    {
+        NNUEAccumulator *acc = &stack[p];
+        for (int i = 0; i < acc->num_added; i++)
+            sub[i] = nnue_feature(side, king_key, acc->added[i]);
+        for (int i = 0; i < acc->num_removed; i++)
+            add[i] = nnue_feature(side, king_key, acc->removed[i]);
+        nnue_apply(stack[p - 1].hidden1[side], acc->hidden1[side], add, acc->num_removed, sub, acc->num_added);
+        stack[p - 1].computed |= bit;
+    }
+}
+
+// Second hidden layer's bias and clipped ReLU, then the output layer.
+// Shared by all kernel sets; only 32 values.
+static int nnue_output(const int32_t *hidden2)
+{
+    int32_t output = nnue_net->output_bias;
     for (int i = 0; i < NNUE_HIDDEN2_SIZE; i++)
     {
-        output += hidden2[i] * nnue_weights.hidden2_weights[i];
+        int32_t x = hidden2[i] + nnue_net->hidden2_bias[i];
+        x = x < 0 ? 0 : x >> nnue_hidden1_shift;
+        if (x > NNUE_ACT_MAX)
+            x = NNUE_ACT_MAX;
+        output += x * nnue_net->hidden2_weights[i];
     }
 
-    // Scale and return
-    int score = (int)(output * NNUE_SCALE);
-    return (side == white) ? score : -score;
+    // Scale and return; already from the side to move's point of view
+    return (int)((int64_t)output * NNUE_SCALE / (NNUE_ACT_MAX << nnue_hidden2_shift));
+}
+
+// NNUE Evaluation
+int evaluate_nnue(const Position *pos)
+{
+    if (!nnue_loaded)
+        return 0;
+
+    // The accumulator stack is a cache: filling it does not change the
+    // position, so evaluation keeps its const signature
+    nnue_update((Position *)pos, white);
+    nnue_update((Position *)pos, black);
+    const NNUEAccumulator *acc = &pos->nnue_stack[pos->nnue_top];
+
+    _Alignas(64) uint8_t hidden1[NNUE_L2_INPUT_SIZE];
+    _Alignas(64) int32_t hidden2[NNUE_HIDDEN2_SIZE];
+    nnue_activate(acc->hidden1[pos->side], hidden1);
+    nnue_activate(acc->hidden1[pos->side ^ 1], hidden1 + NNUE_HIDDEN1_SIZE);
+    nnue_affine(hidden1, hidden2);
+    return nnue_output(hidden2);
+}
+
+// Name of kernel set 'kernel', or NULL past the last one
+const char *nnue_kernel_name(int kernel)
+{
+    return kernel >= 0 && kernel < NNUE_KERNEL_COUNT ? nnue_kernels[kernel].name : NULL;
+}
+
+// Evaluate from scratch with one kernel set, ignoring the accumulator
+// stack; "benchnnue" compares the sets on the same positions
+int evaluate_nnue_kernel(const Position *pos, int kernel)
+{
+    const NNUEKernels *kernels = &nnue_kernels[kernel];
+    _Alignas(64) int16_t acc[NNUE_HIDDEN1_SIZE];
+    _Alignas(64) uint8_t hidden1[NNUE_L2_INPUT_SIZE];
+    _Alignas(64) int32_t hidden2[NNUE_HIDDEN2_SIZE];
+    int features[64];
+
+    for (int half = 0; half < 2; half++)
+    {
+        int count = nnue_features(pos, pos->side ^ half, features);
+        kernels->apply(acc, nnue_net->hidden1_bias, features, count, NULL, 0);
+        kernels->activate(acc, hidden1 + half * NNUE_HIDDEN1_SIZE);
+    }
+    kernels->affine(hidden1, hidden2);
+    return nnue_output(hidden2);
 }
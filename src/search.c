@@ -8,21 +8,34 @@
 #include <stdlib.h>
 
 // External function declarations
-extern int evaluate();
-extern int is_square_attacked(int square, int attacking_side);
-extern void generate_moves(moves *move_list);
-extern int make_move(int move, int move_flag);
+extern int evaluate(const Position *pos);
+extern int is_square_attacked(const Position *pos, int square, int attacking_side);
+extern void generate_captures(const Position *pos, moves *move_list);
+extern void generate_quiets(const Position *pos, moves *move_list);
+extern void generate_legal_moves(const Position *pos, moves *move_list);
+extern void generate_quiet_checks(const Position *pos, moves *move_list);
+extern void add_move(moves *move_list, int move);
+extern void init_check_info(const Position *pos, CheckInfo *ci);
+extern int gives_check(const Position *pos, const CheckInfo *ci, int move);
+extern int is_pseudo_legal(const Position *pos, int move);
+extern int is_legal(const Position *pos, int move);
+extern int make_move(Position *pos, int move, int move_flag, undo_info *undo);
+extern void unmake_move(Position *pos, int move, const undo_info *undo);
+extern void make_null_move(Position *pos, undo_info *undo);
+extern void unmake_null_move(Position *pos, const undo_info *undo);
 extern void print_move(int move);
 extern U64 get_bishop_attacks_magic(int square, U64 occupancy);
 extern U64 get_rook_attacks_magic(int square, U64 occupancy);
+extern U64 attackers_to(const Position *pos, int square, U64 occupancy);
 
 // Time management externals
-extern void communicate();
-extern int read_tt(int alpha, int beta, int depth, int ply);
-extern void write_tt(int depth, int score, int flag, int best_move, int ply);
-extern int get_tt_move();
-extern int get_tt_score_raw(int ply, int *tt_depth_out, int *tt_flags_out);
-extern int is_repetition();
+extern void communicate(SearchContext *ctx);
+extern int read_tt(U64 key, int alpha, int beta, int depth, int ply);
+extern void write_tt(U64 key, int depth, int score, int flag, int best_move, int static_eval, int ply);
+extern int get_tt_move(const Position *pos);
+extern int get_tt_eval(U64 key);
+extern int get_tt_score_raw(U64 key, int ply, int *tt_depth_out, int *tt_flags_out);
+extern int is_repetition(const Position *pos);
 extern int square_distance(int sq1, int sq2);
 
 // MVV-LVA (Most Valuable Victim - Least Valuable Attacker) scores
@@ -46,255 +59,155 @@ static int mvv_lva_scores[12][12] = {
 //              SEE (Static Exchange Eval)      \\
 // ============================================ \\
 
-// Get smallest attacker to a square
-int get_smallest_attacker(int square, int side, int *from_square)
+// Value a move puts on the board before any recapture: the victim (a pawn
+// for en passant) plus what a promotion gains
+static int see_move_gain(const Position *pos, int move)
 {
-    *from_square = -1;
-
-    // Pawns
-    U64 pawn_attackers = pawn_attacks[side ^ 1][square] & bitboards[side == white ? P : p];
-    if (pawn_attackers)
-    {
-        *from_square = get_ls1b_index(pawn_attackers);
-        return see_piece_values[0]; // Pawn
-    }
-
-    // Knights
-    U64 knight_attackers = knight_attacks[square] & bitboards[side == white ? N : n];
-    if (knight_attackers)
-    {
-        *from_square = get_ls1b_index(knight_attackers);
-        return see_piece_values[1]; // Knight
-    }
-
-    // Bishops
-    U64 bishop_attackers = get_bishop_attacks_magic(square, occupancies[both]) & bitboards[side == white ? B : b];
-    if (bishop_attackers)
-    {
-        *from_square = get_ls1b_index(bishop_attackers);
-        return see_piece_values[2]; // Bishop
-    }
-
-    // Rooks
-    U64 rook_attackers = get_rook_attacks_magic(square, occupancies[both]) & bitboards[side == white ? R : r];
-    if (rook_attackers)
-    {
-        *from_square = get_ls1b_index(rook_attackers);
-        return see_piece_values[3]; // Rook
-    }
-
-    // Queens
-    U64 queen_attackers = (get_bishop_attacks_magic(square, occupancies[both]) |
-                           get_rook_attacks_magic(square, occupancies[both])) &
-                          bitboards[side == white ? Q : q];
-    if (queen_attackers)
-    {
-        *from_square = get_ls1b_index(queen_attackers);
-        return see_piece_values[4]; // Queen
-    }
+    int to = get_move_target(move);
+    int promoted = get_move_promoted(move);
+    int gain = 0;
 
-    // Kings
-    U64 king_attackers = king_attacks[square] & bitboards[side == white ? K : k];
-    if (king_attackers)
-    {
-        *from_square = get_ls1b_index(king_attackers);
-        return see_piece_values[5]; // King
-    }
+    if (get_move_enpassant(move))
+        gain = see_piece_values[0];
+    else if (get_move_capture(move) && pos->piece_on[to] != no_piece)
+        gain = see_piece_values[pos->piece_on[to] % 6];
 
-    return 0;
+    if (promoted)
+        gain += see_piece_values[promoted % 6] - see_piece_values[0];
+    return gain;
 }
 
-// Static Exchange Evaluation
-int see(int move)
+// Occupancy once the move is made; the target square itself never blocks
+// a line to it, so it is simply left out
+static U64 see_occupancy(const Position *pos, int move)
 {
     int from = get_move_source(move);
     int to = get_move_target(move);
-    int piece = get_move_piece(move);
+    U64 occ = pos->occupancies[both] & ~(1ULL << from) & ~(1ULL << to);
 
-    // Determine attacker value
-    int attacker_value;
-    switch (piece % 6)
-    {
-    case 0:
-        attacker_value = see_piece_values[0];
-        break; // Pawn
-    case 1:
-        attacker_value = see_piece_values[1];
-        break; // Knight
-    case 2:
-        attacker_value = see_piece_values[2];
-        break; // Bishop
-    case 3:
-        attacker_value = see_piece_values[3];
-        break; // Rook
-    case 4:
-        attacker_value = see_piece_values[4];
-        break; // Queen
-    case 5:
-        attacker_value = see_piece_values[5];
-        break; // King
-    default:
-        attacker_value = 100;
-    }
+    if (get_move_enpassant(move))
+        pop_bit(occ, (pos->side == white) ? to + 8 : to - 8);
+    return occ;
+}
 
-    // Determine victim value
-    int victim_value = 0;
-    if (get_move_capture(move))
-    {
-        int start_piece = (side == white) ? p : P;
-        int end_piece = (side == white) ? k : K;
-        for (int pp = start_piece; pp <= end_piece; pp++)
-        {
-            if (get_bit(bitboards[pp], to))
-            {
-                switch (pp % 6)
-                {
-                case 0:
-                    victim_value = see_piece_values[0];
-                    break;
-                case 1:
-                    victim_value = see_piece_values[1];
-                    break;
-                case 2:
-                    victim_value = see_piece_values[2];
-                    break;
-                case 3:
-                    victim_value = see_piece_values[3];
-                    break;
-                case 4:
-                    victim_value = see_piece_values[4];
-                    break;
-                case 5:
-                    victim_value = see_piece_values[5];
-                    break;
-                }
-                break;
-            }
-        }
-    }
+// Take the least valuable of 'side_attackers' off 'occ' and add the sliders
+// it uncovers to 'attackers'. Returns the piece type (0 = pawn .. 5 = king).
+static int see_pop_attacker(const Position *pos, int square, int side, U64 side_attackers, U64 *occ, U64 *attackers)
+{
+    int base = (side == white) ? P : p;
+    int type = 0;
+    U64 bitboard;
+
+    while (!(bitboard = side_attackers & pos->bitboards[base + type]))
+        type++;
+
+    *occ ^= bitboard & -bitboard;
+
+    // Pawns, bishops and queens leave from a diagonal, rooks and queens
+    // from a line
+    if (type == 0 || type == 2 || type == 4)
+        *attackers |= get_bishop_attacks_magic(square, *occ) &
+                      (pos->bitboards[B] | pos->bitboards[b] | pos->bitboards[Q] | pos->bitboards[q]);
+    if (type == 3 || type == 4)
+        *attackers |= get_rook_attacks_magic(square, *occ) &
+                      (pos->bitboards[R] | pos->bitboards[r] | pos->bitboards[Q] | pos->bitboards[q]);
+    *attackers &= *occ;
+    return type;
+}
+
+// Static Exchange Evaluation: material balance of the capture sequence on
+// the target square, each side recapturing with its least valuable piece
+// and free to stop. X-ray attackers join as the pieces in front leave.
+int see(const Position *pos, int move)
+{
+    if (get_move_castling(move))
+        return 0;
+
+    int to = get_move_target(move);
+    int promoted = get_move_promoted(move);
+    U64 occ = see_occupancy(pos, move);
+    U64 attackers = attackers_to(pos, to, occ) & occ;
 
-    // Simple approximation: gain is victim - attacker if we lose our piece
     int gain[32];
     int d = 0;
+    gain[0] = see_move_gain(pos, move);
 
-    // We're copying board state conceptually
-    U64 occ = occupancies[both];
-    pop_bit(occ, from);
+    // Value of the piece standing on the square, next to be captured
+    int on_square = see_piece_values[(promoted ? promoted : get_move_piece(move)) % 6];
+    int side = pos->side;
 
-    gain[d] = victim_value;
-    int current_side = side ^ 1;
-    int current_attacker = attacker_value;
-
-    while (1)
+    while (d < 31)
     {
-        d++;
-        int from_sq;
-        int next_attacker = get_smallest_attacker(to, current_side, &from_sq);
-
-        if (next_attacker == 0)
+        side ^= 1;
+        U64 side_attackers = attackers & pos->occupancies[side];
+        if (!side_attackers)
             break;
 
-        // Stand pat
-        gain[d] = current_attacker - gain[d - 1];
-
-        // Remove attacker from occupancy
-        if (from_sq >= 0)
-            pop_bit(occ, from_sq);
-
-        current_attacker = next_attacker;
-        current_side ^= 1;
-
-        if (d >= 30)
-            break;
+        d++;
+        gain[d] = on_square - gain[d - 1];
+        on_square = see_piece_values[see_pop_attacker(pos, to, side, side_attackers, &occ, &attackers)];
     }
 
-    // Negamax the gain array
-    while (--d > 0)
+    // Each side takes the better of recapturing and stopping
+    while (d > 0)
     {
-        gain[d - 1] = -(gain[d] > -gain[d - 1] ? -gain[d - 1] : gain[d]);
+        d--;
+        gain[d] = -(-gain[d] > gain[d + 1] ? -gain[d] : gain[d + 1]);
     }
 
     return gain[0];
 }
 
-// SEE greater-than-or-equal threshold test
-int see_ge(int move, int threshold)
+// SEE >= threshold without the full swap list: stops as soon as the side
+// to move on the square can no longer change the answer
+int see_ge(const Position *pos, int move, int threshold)
 {
-    int from = get_move_source(move);
+    if (get_move_castling(move))
+        return 0 >= threshold;
+
     int to = get_move_target(move);
-    int piece = get_move_piece(move);
+    int promoted = get_move_promoted(move);
 
-    // Quick wins for obvious cases
-    if (!get_move_capture(move))
-        return 0 >= threshold; // Non-captures: SEE = 0
+    // Even if the piece is not recaptured the threshold is missed
+    int swap = see_move_gain(pos, move) - threshold;
+    if (swap < 0)
+        return 0;
 
-    // Get victim value
-    int victim_value = 0;
-    {
-        int start_piece = (side == white) ? p : P;
-        int end_piece = (side == white) ? k : K;
-        for (int pp = start_piece; pp <= end_piece; pp++)
-        {
-            if (get_bit(bitboards[pp], to))
-            {
-                switch (pp % 6)
-                {
-                case 0:
-                    victim_value = see_piece_values[0];
-                    break;
-                case 1:
-                    victim_value = see_piece_values[1];
-                    break;
-                case 2:
-                    victim_value = see_piece_values[2];
-                    break;
-                case 3:
-                    victim_value = see_piece_values[3];
-                    break;
-                case 4:
-                    victim_value = see_piece_values[4];
-                    break;
-                case 5:
-                    victim_value = see_piece_values[5];
-                    break;
-                }
-                break;
-            }
-        }
-    }
+    // Even if it is the threshold is met
+    swap = see_piece_values[(promoted ? promoted : get_move_piece(move)) % 6] - swap;
+    if (swap <= 0)
+        return 1;
 
-    // Get attacker value
-    int attacker_value;
-    switch (piece % 6)
+    U64 occ = see_occupancy(pos, move);
+    U64 attackers = attackers_to(pos, to, occ) & occ;
+    int side = pos->side;
+    int result = 1;
+
+    while (1)
     {
-    case 0:
-        attacker_value = see_piece_values[0];
-        break;
-    case 1:
-        attacker_value = see_piece_values[1];
-        break;
-    case 2:
-        attacker_value = see_piece_values[2];
-        break;
-    case 3:
-        attacker_value = see_piece_values[3];
-        break;
-    case 4:
-        attacker_value = see_piece_values[4];
-        break;
-    case 5:
-        attacker_value = see_piece_values[5];
-        break;
-    default:
-        attacker_value = 100;
-    }
+        side ^= 1;
+        U64 side_attackers = attackers & pos->occupancies[side];
+        if (!side_attackers)
+            break;
 
-    // If capturing with lower value piece, almost certainly good
-    if (victim_value >= attacker_value)
-        return (victim_value - attacker_value) >= threshold;
+        // A king may only recapture if nothing defends the square
+        int base = (side == white) ? P : p;
+        if (side_attackers == (side_attackers & pos->bitboards[base + 5]) &&
+            (attackers & pos->occupancies[side ^ 1]))
+            break;
+
+        result ^= 1;
+        int type = see_pop_attacker(pos, to, side, side_attackers, &occ, &attackers);
+        if (type == 5)
+            break;
 
-    // Otherwise need full SEE
-    return see(move) >= threshold;
+        // 'swap' is what the side that just captured stands to lose
+        swap = see_piece_values[type] - swap;
+        if (swap < result)
+            break;
+    }
+
+    return result;
 }
 
 // ============================================ \\
@@ -306,7 +219,7 @@ int see_ge(int move, int threshold)
 // a replacement for alpha-beta; it simply lets the search examine Boa-style
 // clamps and outposts earlier, which makes cutoffs more relevant to Fe64's
 // intended personality.
-static int constrictor_move_bonus(int move)
+static int constrictor_move_bonus(const Position *pos, int move)
 {
     if (get_move_capture(move) || get_move_promoted(move))
         return 0;
@@ -320,7 +233,7 @@ static int constrictor_move_bonus(int move)
     if (file >= 2 && file <= 5)
         bonus += 8; // central clamps restrict more enemy moves
 
-    if ((side == white && rank <= 3) || (side == black && rank >= 4))
+    if ((pos->side == white && rank <= 3) || (pos->side == black && rank >= 4))
         bonus += 10; // occupy enemy half
 
     if (piece == P || piece == p)
@@ -332,100 +245,270 @@ static int constrictor_move_bonus(int move)
     }
     else if (piece == N || piece == n || piece == B || piece == b)
     {
-        U64 enemy_pawns = (side == white) ? bitboards[p] : bitboards[P];
-        U64 pawn_chasers = (side == white) ? pawn_attacks[white][to] : pawn_attacks[black][to];
+        U64 enemy_pawns = (pos->side == white) ? pos->bitboards[p] : pos->bitboards[P];
+        U64 pawn_chasers = (pos->side == white) ? pawn_attacks[white][to] : pawn_attacks[black][to];
         if (!(pawn_chasers & enemy_pawns))
             bonus += 14; // durable outpost candidate
     }
 
-    int enemy_king = (side == white) ? get_ls1b_index(bitboards[k]) : get_ls1b_index(bitboards[K]);
+    int enemy_king = (pos->side == white) ? get_ls1b_index(pos->bitboards[k]) : get_ls1b_index(pos->bitboards[K]);
     if (enemy_king != -1 && square_distance(to, enemy_king) <= 3)
         bonus += 10; // tighten the vise around the king
 
     return bonus;
 }
 
-int score_move(int move, int pv_move, int ply)
+// MVV-LVA plus capture history; SEE is left to the caller
+static int score_capture(SearchContext *ctx, int move)
 {
-    // PV move from TT
-    if (move == pv_move)
-        return 2000000;
+    const Position *pos = &ctx->pos;
+    int piece = get_move_piece(move);
+    int target = get_move_target(move);
 
-    // Captures - MVV-LVA + SEE + capture history
-    if (get_move_capture(move))
-    {
-        int piece = get_move_piece(move);
-        int target = get_move_target(move);
-
-        // Find victim piece
-        int victim = P;
-        int start = (side == white) ? p : P;
-        int end = (side == white) ? k : K;
-        for (int p = start; p <= end; p++)
-        {
-            if (get_bit(bitboards[p], target))
-            {
-                victim = p;
-                break;
-            }
-        }
+    // Find victim piece (the target is empty for en passant)
+    int victim = pos->piece_on[target];
+    if (victim == no_piece)
+        victim = P;
+
+    return mvv_lva_scores[piece][victim] + ctx->capture_history[piece][target][victim % 6] / 10;
+}
 
-        // MVV-LVA base score
-        int mvv_lva = mvv_lva_scores[piece][victim];
+// History, butterfly history and the constrictor bonus
+static int score_quiet(SearchContext *ctx, int move)
+{
+    const Position *pos = &ctx->pos;
+    int hist = ctx->history_moves[get_move_piece(move)][get_move_target(move)];
+    int bfly = ctx->butterfly_history[pos->side][get_move_source(move)][get_move_target(move)];
 
-        // Add capture history
-        int cap_hist = capture_history[piece][target][victim % 6];
+    return hist + bfly / 2 + constrictor_move_bonus(pos, move);
+}
 
-        // SEE bonus for good captures, penalty for bad
-        int see_score = 0;
-        if (see_ge(move, 0))
-            see_score = 50000;
-        else
-            see_score = -50000;
+// ============================================ \\
+//              MOVE PICKER                     \\
+// ============================================ \\
 
-        return 1000000 + mvv_lva + cap_hist / 10 + see_score;
+// Captures and queen promotions come from generate_captures(), every
+// other move from generate_quiets()
+#define is_capture_stage_move(move) \
+    (get_move_promoted(move) ? get_move_promoted(move) % 6 == Q : get_move_capture(move))
+
+// Decode 'move_list' into 'scored' with the ordering score for its subset:
+// gen_captures, gen_quiets, or gen_all (evasions: captures first)
+static int score_moves(SearchContext *ctx, const moves *move_list, scored_move *scored, int type)
+{
+    for (int i = 0; i < move_list->count; i++)
+    {
+        int move = decode_with_position(&ctx->pos, move_list->moves[i]);
+        scored[i].move = move;
+        if (type == gen_captures)
+            scored[i].score = score_capture(ctx, move);
+        else if (type == gen_quiets)
+            scored[i].score = score_quiet(ctx, move);
+        else
+            scored[i].score = get_move_capture(move) ? 1000000 + score_capture(ctx, move) : score_quiet(ctx, move);
     }
+    return move_list->count;
+}
+
+// Selection-sort step: swap the best move in [index, end) to 'index' and
+// return it, or 0 when the range is empty
+static int pick_best(scored_move *list, int *index, int end)
+{
+    if (*index >= end)
+        return 0;
 
-    // Killer moves
-    if (killer_moves[0][ply] == move)
-        return 900000;
-    if (killer_moves[1][ply] == move)
-        return 800000;
+    int best_idx = *index;
+    for (int next = *index + 1; next < end; next++)
+        if (list[next].score > list[best_idx].score)
+            best_idx = next;
 
-    // Counter-move bonus
-    if (ply > 0 && last_move_made[ply - 1])
+    scored_move best = list[best_idx];
+    list[best_idx] = list[*index];
+    list[*index] = best;
+
+    (*index)++;
+    return best.move;
+}
+
+// 'captures_only' hands out just the TT move (if it is a winning capture)
+// and the good captures, for probcut
+void init_move_picker(SearchContext *ctx, MovePicker *mp, int tt_move, int ply, int captures_only)
+{
+    mp->stage = STAGE_TT_MOVE;
+    mp->index = 0;
+    mp->tt_move = tt_move;
+    mp->captures_only = captures_only;
+    mp->end = 0;
+    mp->bad_captures_end = 0;
+
+    mp->refutations[0] = decode_with_position(&ctx->pos, ctx->killer_moves[0][ply]);
+    mp->refutations[1] = decode_with_position(&ctx->pos, ctx->killer_moves[1][ply]);
+    mp->refutations[2] = 0;
+    if (ply > 0 && ctx->last_move_made[ply - 1])
     {
-        int lm = last_move_made[ply - 1];
-        if (counter_moves[get_move_piece(lm)][get_move_target(lm)] == move)
-            return 700000;
+        int lm = ctx->last_move_made[ply - 1];
+        mp->refutations[2] = decode_with_position(&ctx->pos, ctx->counter_moves[get_move_piece(lm)][get_move_target(lm)]);
     }
 
-    // History heuristic
-    int hist = history_moves[get_move_piece(move)][get_move_target(move)];
+    // Each refutation is handed out once
+    if (mp->refutations[1] == mp->refutations[0])
+        mp->refutations[1] = 0;
+    if (mp->refutations[2] == mp->refutations[0] || mp->refutations[2] == mp->refutations[1])
+        mp->refutations[2] = 0;
+}
 
-    // Butterfly history
-    int from = get_move_source(move);
-    int to = get_move_target(move);
-    int bfly = butterfly_history[side][from][to];
+// Next pseudo-legal move, or 0 when the picker is exhausted
+int next_move(SearchContext *ctx, MovePicker *mp)
+{
+    const Position *pos = &ctx->pos;
+    int move;
 
-    return hist + bfly / 2 + constrictor_move_bonus(move);
+    switch (mp->stage)
+    {
+    case STAGE_TT_MOVE:
+        mp->stage = STAGE_INIT_CAPTURES;
+
+        // The TT move is checked against the board and searched before
+        // anything is generated; one that fails the check is dropped
+        if (mp->tt_move && is_pseudo_legal(pos, mp->tt_move) && is_legal(pos, mp->tt_move) &&
+            (!mp->captures_only || (is_capture_stage_move(mp->tt_move) && see_ge(pos, mp->tt_move, 0))))
+            return mp->tt_move;
+        mp->tt_move = 0;
+        // fall through
+
+    case STAGE_INIT_CAPTURES:
+        generate_captures(pos, mp->generated);
+        mp->end = score_moves(ctx, mp->generated, mp->list, gen_captures);
+        mp->index = 0;
+        mp->stage = STAGE_GOOD_CAPTURES;
+        // fall through
+
+    case STAGE_GOOD_CAPTURES:
+        while ((move = pick_best(mp->list, &mp->index, mp->end)))
+        {
+            if (move == mp->tt_move)
+                continue;
+
+            // SEE only for the captures we actually reach; losers go to
+            // the already-picked front of the list
+            if (!see_ge(pos, move, 0))
+            {
+                mp->list[mp->bad_captures_end++] = mp->list[mp->index - 1];
+                continue;
+            }
+            return move;
+        }
+        if (mp->captures_only)
+        {
+            mp->stage = STAGE_DONE;
+            return 0;
+        }
+        mp->stage = STAGE_KILLER_1;
+        // fall through
+
+    case STAGE_KILLER_1:
+    case STAGE_KILLER_2:
+    case STAGE_COUNTER:
+        while (mp->stage <= STAGE_COUNTER)
+        {
+            move = mp->refutations[mp->stage - STAGE_KILLER_1];
+            mp->stage++;
+
+            // Refutations come from other positions: only play them if they
+            // are legal quiets here
+            if (move && move != mp->tt_move && !is_capture_stage_move(move) &&
+                is_pseudo_legal(pos, move) && is_legal(pos, move))
+                return move;
+        }
+        // fall through
+
+    case STAGE_INIT_QUIETS:
+        generate_quiets(pos, mp->generated);
+        mp->index = mp->bad_captures_end;
+        mp->end = mp->index + score_moves(ctx, mp->generated, mp->list + mp->index, gen_quiets);
+        mp->stage = STAGE_QUIETS;
+        // fall through
+
+    case STAGE_QUIETS:
+        while ((move = pick_best(mp->list, &mp->index, mp->end)))
+        {
+            if (move == mp->tt_move || move == mp->refutations[0] ||
+                move == mp->refutations[1] || move == mp->refutations[2])
+                continue;
+            return move;
+        }
+        mp->index = 0;
+        mp->stage = STAGE_BAD_CAPTURES;
+        // fall through
+
+    case STAGE_BAD_CAPTURES:
+        if (mp->index < mp->bad_captures_end)
+            return mp->list[mp->index++].move;
+        mp->stage = STAGE_DONE;
+        // fall through
+
+    default:
+        return 0;
+    }
 }
 
 // ============================================ \\
 //              QUIESCENCE SEARCH               \\
 // ============================================ \\
 
-int quiescence(int alpha, int beta)
+// Captures and queen promotions only, plus quiet checks on the first
+// qsearch ply when the QSearchChecks option is on ('depth' is 0 on entry
+// from negamax and counts down). A side
+// in check cannot stand pat and searches all of its evasions instead.
+int quiescence(SearchContext *ctx, int alpha, int beta, int ply, int depth)
 {
+    Position *pos = &ctx->pos;
+
     // Time check - check more frequently (every 1024 nodes)
-    if ((nodes & 1023) == 0)
-        communicate();
+    if ((ctx->nodes & 1023) == 0)
+        communicate(ctx);
     if (times_up)
         return 0;
 
-    nodes++;
+    ctx->nodes++;
 
-    int stand_pat = evaluate();
+    if (ply >= MAX_PLY - 1)
+        return evaluate(pos);
+
+    moves move_list[1];
+    scored_move scored[256];
+    int index = 0;
+    int move;
+
+    int in_check = is_square_attacked(pos,
+        (pos->side == white) ? get_ls1b_index(pos->bitboards[K]) : get_ls1b_index(pos->bitboards[k]),
+        pos->side ^ 1);
+
+    if (in_check)
+    {
+        generate_legal_moves(pos, move_list);
+        if (move_list->count == 0)
+            return -MATE + ply;
+
+        int end = score_moves(ctx, move_list, scored, gen_all);
+        while ((move = pick_best(scored, &index, end)))
+        {
+            undo_info undo;
+            make_move(pos, move, legal_move, &undo);
+            int score = -quiescence(ctx, -beta, -alpha, ply + 1, depth - 1);
+            unmake_move(pos, move, &undo);
+
+            if (times_up)
+                return 0;
+            if (score >= beta)
+                return beta;
+            if (score > alpha)
+                alpha = score;
+        }
+        return alpha;
+    }
+
+    int stand_pat = evaluate(pos);
 
     // Standing pat cutoff
     if (stand_pat >= beta)
@@ -439,55 +522,18 @@ int quiescence(int alpha, int beta)
     if (alpha < stand_pat)
         alpha = stand_pat;
 
-    moves move_list[1];
-    generate_moves(move_list);
-
-    // Score and sort captures only
-    int scores[256];
-    for (int i = 0; i < move_list->count; i++)
-    {
-        if (get_move_capture(move_list->moves[i]))
-            scores[i] = score_move(move_list->moves[i], 0, 0);
-        else
-            scores[i] = -1000000;
-    }
-
-    for (int count = 0; count < move_list->count; count++)
+    generate_captures(pos, move_list);
+    int end = score_moves(ctx, move_list, scored, gen_captures);
+    while ((move = pick_best(scored, &index, end)))
     {
-        // Selection sort
-        int best_idx = count;
-        for (int next = count + 1; next < move_list->count; next++)
-        {
-            if (scores[next] > scores[best_idx])
-                best_idx = next;
-        }
-
-        // Swap
-        if (best_idx != count)
-        {
-            int temp_move = move_list->moves[count];
-            move_list->moves[count] = move_list->moves[best_idx];
-            move_list->moves[best_idx] = temp_move;
-
-            int temp_score = scores[count];
-            scores[count] = scores[best_idx];
-            scores[best_idx] = temp_score;
-        }
-
-        // Skip non-captures
-        if (!get_move_capture(move_list->moves[count]))
-            continue;
-
         // SEE pruning - skip bad captures
-        if (!see_ge(move_list->moves[count], 0))
+        if (!see_ge(pos, move, 0))
             continue;
 
-        copy_board();
-        if (!make_move(move_list->moves[count], only_captures))
-            continue;
-
-        int score = -quiescence(-beta, -alpha);
-        take_back();
+        undo_info undo;
+        make_move(pos, move, legal_move, &undo);
+        int score = -quiescence(ctx, -beta, -alpha, ply + 1, depth - 1);
+        unmake_move(pos, move, &undo);
 
         if (times_up)
             return 0;
@@ -497,6 +543,28 @@ int quiescence(int alpha, int beta)
         if (score > alpha)
             alpha = score;
     }
+
+    // Quiet checks on the first ply only
+    if (qsearch_checks && depth == 0)
+    {
+        generate_quiet_checks(pos, move_list);
+        for (int i = 0; i < move_list->count; i++)
+        {
+            move = decode_with_position(pos, move_list->moves[i]);
+            undo_info undo;
+            make_move(pos, move, legal_move, &undo);
+            int score = -quiescence(ctx, -beta, -alpha, ply + 1, depth - 1);
+            unmake_move(pos, move, &undo);
+
+            if (times_up)
+                return 0;
+
+            if (score >= beta)
+                return beta;
+            if (score > alpha)
+                alpha = score;
+        }
+    }
     return alpha;
 }
 
@@ -504,22 +572,24 @@ int quiescence(int alpha, int beta)
 //              NEGAMAX SEARCH                  \\
 // ============================================ \\
 
-int negamax(int alpha, int beta, int depth, int ply)
+int negamax(SearchContext *ctx, int alpha, int beta, int depth, int ply)
 {
+    Position *pos = &ctx->pos;
+
     // Initialize PV length
-    pv_length[ply] = ply;
+    ctx->pv_length[ply] = ply;
 
     // Is this a PV node?
     int pv_node = (beta - alpha > 1);
 
     // Time check - check more frequently (every 1024 nodes)
-    if ((nodes & 1023) == 0)
-        communicate();
+    if ((ctx->nodes & 1023) == 0)
+        communicate(ctx);
     if (times_up)
         return 0;
 
     // Repetition detection
-    if (ply > 0 && is_repetition())
+    if (ply > 0 && is_repetition(pos))
         return 0;
 
     // Mate distance pruning - if we already found a mate closer to root
@@ -538,76 +608,70 @@ int negamax(int alpha, int beta, int depth, int ply)
     int tt_flags = 0;
     int raw_tt_score = -INF - 1;
 
-    if (!excluded_move[ply])
+    if (!ctx->excluded_move[ply])
     {
-        tt_score = read_tt(alpha, beta, depth, ply);
-        pv_move = get_tt_move();
-        raw_tt_score = get_tt_score_raw(ply, &tt_depth, &tt_flags);
+        tt_score = read_tt(pos->hash_key, alpha, beta, depth, ply);
+        pv_move = get_tt_move(pos);
+        raw_tt_score = get_tt_score_raw(pos->hash_key, ply, &tt_depth, &tt_flags);
 
         if (tt_score != -INF - 1 && ply)
             return tt_score;
     }
     else
     {
-        pv_move = get_tt_move(); // Still get TT move for ordering
+        pv_move = get_tt_move(pos); // Still get TT move for ordering
     }
 
     // Base case: quiescence
     if (depth <= 0)
-        return quiescence(alpha, beta);
+        return quiescence(ctx, alpha, beta, ply, 0);
 
-    nodes++;
+    ctx->nodes++;
 
     // Safety check
     if (ply >= MAX_PLY - 1)
-        return evaluate();
+        return evaluate(pos);
 
-    // Check detection
-    int in_check = is_square_attacked(
-        (side == white) ? get_ls1b_index(bitboards[K]) : get_ls1b_index(bitboards[k]),
-        side ^ 1);
+    CheckInfo check_info;
+    init_check_info(pos, &check_info);
+    int in_check = check_info.checkers != 0;
 
     // Check extension - but limit to prevent explosion
     // Only extend if we're not too deep already
     if (in_check && depth < MAX_PLY / 2)
         depth++;
 
-    // Static evaluation for pruning decisions
-    int static_eval = evaluate();
-    static_eval_stack[ply] = static_eval;
+    // Static evaluation for pruning decisions, reusing the one stored in
+    // the TT when this position has been seen before
+    int static_eval = get_tt_eval(pos->hash_key);
+    if (static_eval == TT_NO_EVAL)
+        static_eval = evaluate(pos);
+    ctx->static_eval_stack[ply] = static_eval;
 
     // Improving flag - position is getting better compared to 2 plies ago
-    int improving = (ply >= 2 && static_eval > static_eval_stack[ply - 2]);
+    int improving = (ply >= 2 && static_eval > ctx->static_eval_stack[ply - 2]);
 
     // Null move pruning (with verification)
-    int non_pawn_material = (side == white) ? (count_bits(bitboards[N]) + count_bits(bitboards[B]) + count_bits(bitboards[R]) + count_bits(bitboards[Q])) : (count_bits(bitboards[n]) + count_bits(bitboards[b]) + count_bits(bitboards[r]) + count_bits(bitboards[q]));
+    int non_pawn_material = (pos->side == white) ? (count_bits(pos->bitboards[N]) + count_bits(pos->bitboards[B]) + count_bits(pos->bitboards[R]) + count_bits(pos->bitboards[Q])) : (count_bits(pos->bitboards[n]) + count_bits(pos->bitboards[b]) + count_bits(pos->bitboards[r]) + count_bits(pos->bitboards[q]));
 
     if (depth >= 3 && !in_check && ply > 0 && non_pawn_material > 1)
     {
-        copy_board();
-
-        int old_rep_index = repetition_index;
-
-        side ^= 1;
-        hash_key ^= side_key;
-        repetition_index++;
-        repetition_table[repetition_index] = hash_key;
+        undo_info undo;
+        int old_rep_index = pos->repetition_index;
 
-        if (en_passant != no_sq)
-        {
-            hash_key ^= enpassant_keys[en_passant];
-            en_passant = no_sq;
-        }
+        make_null_move(pos, &undo);
+        pos->repetition_index++;
+        pos->repetition_table[pos->repetition_index] = pos->hash_key;
 
         // Adaptive null move reduction
         int R = 3 + depth / 3 + (depth > 6 ? 1 : 0);
         if (R > depth - 1)
             R = depth - 1;
 
-        int score = -negamax(-beta, -beta + 1, depth - 1 - R, ply + 1);
+        int score = -negamax(ctx, -beta, -beta + 1, depth - 1 - R, ply + 1);
 
-        repetition_index = old_rep_index;
-        take_back();
+        pos->repetition_index = old_rep_index;
+        unmake_null_move(pos, &undo);
 
         if (times_up)
             return 0;
@@ -626,7 +690,7 @@ int negamax(int alpha, int beta, int depth, int ply)
         int razor_margin = 300 + 60 * depth;
         if (static_eval + razor_margin < alpha)
         {
-            int razor_score = quiescence(alpha - razor_margin, beta - razor_margin);
+            int razor_score = quiescence(ctx, alpha - razor_margin, beta - razor_margin, ply, 0);
             if (razor_score + razor_margin <= alpha)
                 return alpha;
         }
@@ -642,51 +706,25 @@ int negamax(int alpha, int beta, int depth, int ply)
         if (probcut_depth < 1)
             probcut_depth = 1;
 
-        moves probcut_moves[1];
-        generate_moves(probcut_moves);
+        // TT move and winning captures only
+        MovePicker probcut_picker;
+        init_move_picker(ctx, &probcut_picker, pv_move, ply, 1);
 
-        // Score and sort for probcut (only try captures and good moves)
-        int pc_scores[256];
-        for (int i = 0; i < probcut_moves->count; i++)
-            pc_scores[i] = score_move(probcut_moves->moves[i], pv_move, ply);
-
-        for (int i = 0; i < probcut_moves->count; i++)
+        int pc_move;
+        while ((pc_move = next_move(ctx, &probcut_picker)))
         {
-            // Selection sort
-            int best_idx = i;
-            for (int j = i + 1; j < probcut_moves->count; j++)
-                if (pc_scores[j] > pc_scores[best_idx])
-                    best_idx = j;
-            if (best_idx != i)
-            {
-                int tmp = probcut_moves->moves[i];
-                probcut_moves->moves[i] = probcut_moves->moves[best_idx];
-                probcut_moves->moves[best_idx] = tmp;
-                int ts = pc_scores[i];
-                pc_scores[i] = pc_scores[best_idx];
-                pc_scores[best_idx] = ts;
-            }
-
-            // Only try captures for probcut
-            if (!get_move_capture(probcut_moves->moves[i]))
+            undo_info undo;
+            int old_rep = pos->repetition_index;
+            if (!make_move(pos, pc_move, legal_move, &undo))
                 continue;
-
-            // Skip bad captures
-            if (!see_ge(probcut_moves->moves[i], 0))
-                continue;
-
-            copy_board();
-            int old_rep = repetition_index;
-            if (!make_move(probcut_moves->moves[i], all_moves))
-                continue;
-            repetition_index++;
-            repetition_table[repetition_index] = hash_key;
+            pos->repetition_index++;
+            pos->repetition_table[pos->repetition_index] = pos->hash_key;
 
             // Do a shallow verification search
-            int pc_score = -negamax(-probcut_beta, -probcut_beta + 1, probcut_depth, ply + 1);
+            int pc_score = -negamax(ctx, -probcut_beta, -probcut_beta + 1, probcut_depth, ply + 1);
 
-            repetition_index = old_rep;
-            take_back();
+            pos->repetition_index = old_rep;
+            unmake_move(pos, pc_move, &undo);
 
             if (times_up)
                 return 0;
@@ -704,134 +742,96 @@ int negamax(int alpha, int beta, int depth, int ply)
             return static_eval - futility_margin;
     }
 
-    moves move_list[1];
-    generate_moves(move_list);
-
     // Internal Iterative Deepening (IID)
     if (depth >= 5 && !pv_move && !in_check)
     {
-        int iid_score = negamax(alpha, beta, depth - 3, ply);
+        int iid_score = negamax(ctx, alpha, beta, depth - 3, ply);
         if (!times_up)
-            pv_move = get_tt_move();
+            pv_move = get_tt_move(pos);
     }
 
-    // Score moves
-    int scores[256];
-    for (int i = 0; i < move_list->count; i++)
-    {
-        scores[i] = score_move(move_list->moves[i], pv_move, ply);
-    }
+    MovePicker picker;
+    init_move_picker(ctx, &picker, pv_move, ply, 0);
 
     int moves_searched = 0;
     int best_so_far = -INF;
     int best_move_found = 0;
     int old_alpha = alpha;
 
-    for (int count = 0; count < move_list->count; count++)
-    {
-        // Selection sort
-        int best_idx = count;
-        for (int next = count + 1; next < move_list->count; next++)
-        {
-            if (scores[next] > scores[best_idx])
-                best_idx = next;
-        }
-
-        // Swap
-        if (best_idx != count)
-        {
-            int temp = move_list->moves[count];
-            move_list->moves[count] = move_list->moves[best_idx];
-            move_list->moves[best_idx] = temp;
-
-            int temp_score = scores[count];
-            scores[count] = scores[best_idx];
-            scores[best_idx] = temp_score;
-        }
+    // Quiet moves tried so far, for the history malus on a cutoff
+    int quiets_tried[64];
+    int quiets_tried_count = 0;
 
+    int move;
+    while ((move = next_move(ctx, &picker)))
+    {
         // Skip excluded move (for singular extension search)
-        if (move_list->moves[count] == excluded_move[ply])
+        if (move == ctx->excluded_move[ply])
             continue;
 
-        copy_board();
+        if (!get_move_capture(move) && quiets_tried_count < 64)
+            quiets_tried[quiets_tried_count++] = move;
 
-        int old_rep_index = repetition_index;
+        int is_capture = get_move_capture(move);
+        int is_promotion = get_move_promoted(move);
+        int is_quiet = !is_capture && !is_promotion;
+        int gives_chk = gives_check(pos, &check_info, move);
 
-        if (!make_move(move_list->moves[count], all_moves))
-            continue;
+        // Every move the picker returns is legal: count it before any
+        // pruning so a node whose moves are all pruned is not scored as
+        // mate or stalemate below
+        moves_searched++;
 
-        repetition_index++;
-        repetition_table[repetition_index] = hash_key;
-        last_move_made[ply] = move_list->moves[count];
+        // SEE pruning for bad captures (SEE needs the position before the
+        // move, so this comes ahead of make_move)
+        if (depth <= 8 && !pv_node && is_capture && !see_ge(pos, move, -30 * depth * depth))
+            continue;
 
-        moves_searched++;
-        int score;
+        // SEE pruning for quiet moves at low depths
+        if (depth <= 6 && !pv_node && is_quiet && moves_searched > 3 &&
+            !see_ge(pos, move, -20 * depth))
+            continue;
 
-        int is_capture = get_move_capture(move_list->moves[count]);
-        int is_promotion = get_move_promoted(move_list->moves[count]);
-        int is_quiet = !is_capture && !is_promotion;
-        int gives_check = is_square_attacked(
-            (side == white) ? get_ls1b_index(bitboards[k]) : get_ls1b_index(bitboards[K]),
-            side);
+        // Losing captures are reduced late in the list
+        int losing_capture = is_capture && depth >= 5 && !pv_node && !in_check && !see_ge(pos, move, 0);
 
-        // Late move pruning
-        if (depth <= 7 && !pv_node && !in_check && !gives_check && is_quiet &&
+        // Late move pruning (gives_check is known before the move is made,
+        // so pruned moves are never made)
+        if (depth <= 7 && !pv_node && !in_check && !gives_chk && is_quiet &&
             moves_searched > lmp_margins[depth < 8 ? depth : 7] + (improving ? 3 : 0))
-        {
-            repetition_index = old_rep_index;
-            take_back();
             continue;
-        }
 
         // Futility pruning at move level
-        if (depth <= 6 && !pv_node && !in_check && !gives_check && is_quiet && moves_searched > 1)
-        {
-            if (static_eval + futility_margins[depth] <= alpha)
-            {
-                repetition_index = old_rep_index;
-                take_back();
-                continue;
-            }
-        }
+        if (depth <= 6 && !pv_node && !in_check && !gives_chk && is_quiet && moves_searched > 1 &&
+            static_eval + futility_margins[depth] <= alpha)
+            continue;
 
         // History pruning - prune quiet moves with very negative history
         if (depth <= 4 && !pv_node && !in_check && is_quiet && moves_searched > 1)
         {
-            int hist = history_moves[get_move_piece(move_list->moves[count])][get_move_target(move_list->moves[count])];
+            int hist = ctx->history_moves[get_move_piece(move)][get_move_target(move)];
             int hist_threshold = -1024 * depth;
             if (hist < hist_threshold)
-            {
-                repetition_index = old_rep_index;
-                take_back();
                 continue;
-            }
         }
 
-        // SEE pruning for bad captures
-        if (depth <= 8 && !pv_node && is_capture && !see_ge(move_list->moves[count], -30 * depth * depth))
-        {
-            repetition_index = old_rep_index;
-            take_back();
-            continue;
-        }
+        undo_info undo;
+        int old_rep_index = pos->repetition_index;
 
-        // SEE pruning for quiet moves at low depths
-        if (depth <= 6 && !pv_node && is_quiet && moves_searched > 3 &&
-            !see_ge(move_list->moves[count], -20 * depth))
-        {
-            repetition_index = old_rep_index;
-            take_back();
-            continue;
-        }
+        make_move(pos, move, legal_move, &undo);
+
+        pos->repetition_index++;
+        pos->repetition_table[pos->repetition_index] = pos->hash_key;
+        ctx->last_move_made[ply] = move;
+
+        int score;
 
-        // Extensions
+        // Extensions (checks are extended by the child's in_check)
         int extension = 0;
-        if (gives_check)
-            extension = 1;
 
         // Singular extensions - if TT move appears much better than alternatives
-        if (depth >= 8 && move_list->moves[count] == pv_move && pv_move &&
-            !excluded_move[ply] && !in_check &&
+        if (depth >= 8 && move == pv_move && pv_move &&
+            !ctx->excluded_move[ply] && !in_check &&
             raw_tt_score != -INF - 1 && tt_depth >= depth - 3 &&
             (tt_flags == HASH_EXACT || tt_flags == HASH_BETA))
         {
@@ -839,9 +839,9 @@ int negamax(int alpha, int beta, int depth, int ply)
             int se_depth = (depth - 1) / 2;
 
             // Search all moves except the TT move at reduced depth
-            excluded_move[ply] = pv_move;
-            int se_score = negamax(se_beta - 1, se_beta, se_depth, ply);
-            excluded_move[ply] = 0;
+            ctx->excluded_move[ply] = pv_move;
+            int se_score = negamax(ctx, se_beta - 1, se_beta, se_depth, ply);
+            ctx->excluded_move[ply] = 0;
 
             if (!times_up && se_score < se_beta)
             {
@@ -851,23 +851,25 @@ int negamax(int alpha, int beta, int depth, int ply)
             else if (!times_up && se_score >= beta)
             {
                 // Multi-cut: even without TT move, we exceed beta
+                pos->repetition_index = old_rep_index;
+                unmake_move(pos, move, &undo);
                 return se_score;
             }
         }
 
         // Passed pawn extension
-        if (extension == 0 && (get_move_piece(move_list->moves[count]) == P || get_move_piece(move_list->moves[count]) == p))
+        if (extension == 0 && (get_move_piece(move) == P || get_move_piece(move) == p))
         {
-            int target = get_move_target(move_list->moves[count]);
+            int target = get_move_target(move);
             int rank = target / 8;
-            if ((side == black && rank == 1) || (side == white && rank == 6))
+            if ((pos->side == black && rank == 1) || (pos->side == white && rank == 6))
                 extension = 1;
         }
 
         // PVS + LMR
         if (moves_searched == 1)
         {
-            score = -negamax(-beta, -alpha, depth - 1 + extension, ply + 1);
+            score = -negamax(ctx, -beta, -alpha, depth - 1 + extension, ply + 1);
         }
         else
         {
@@ -882,20 +884,20 @@ int negamax(int alpha, int beta, int depth, int ply)
                     reduction--;
 
                 // Reduce less for killer moves
-                if (move_list->moves[count] == killer_moves[0][ply] ||
-                    move_list->moves[count] == killer_moves[1][ply])
+                if (pack_move(move) == ctx->killer_moves[0][ply] ||
+                    pack_move(move) == ctx->killer_moves[1][ply])
                     reduction--;
 
                 // Reduce less for counter moves
-                if (ply > 0 && last_move_made[ply - 1])
+                if (ply > 0 && ctx->last_move_made[ply - 1])
                 {
-                    int lm = last_move_made[ply - 1];
-                    if (counter_moves[get_move_piece(lm)][get_move_target(lm)] == move_list->moves[count])
+                    int lm = ctx->last_move_made[ply - 1];
+                    if (ctx->counter_moves[get_move_piece(lm)][get_move_target(lm)] == pack_move(move))
                         reduction--;
                 }
 
                 // History-based LMR adjustments
-                int hist = history_moves[get_move_piece(move_list->moves[count])][get_move_target(move_list->moves[count])];
+                int hist = ctx->history_moves[get_move_piece(move)][get_move_target(move)];
                 reduction -= hist / 5000; // Good history reduces less, bad history increases
 
                 // Increase reduction for non-PV nodes at higher depths
@@ -926,21 +928,20 @@ int negamax(int alpha, int beta, int depth, int ply)
             // LMR for captures too (less aggressively)
             else if (moves_searched >= 5 && depth >= 5 && !in_check && is_capture && !pv_node)
             {
-                int see_val = see(move_list->moves[count]);
-                if (see_val < 0)
+                if (losing_capture)
                     reduction = 1 + (depth > 8 ? 1 : 0);
             }
 
-            score = -negamax(-alpha - 1, -alpha, depth - 1 - reduction + extension, ply + 1);
+            score = -negamax(ctx, -alpha - 1, -alpha, depth - 1 - reduction + extension, ply + 1);
 
             if (score > alpha && (reduction > 0 || score < beta))
             {
-                score = -negamax(-beta, -alpha, depth - 1 + extension, ply + 1);
+                score = -negamax(ctx, -beta, -alpha, depth - 1 + extension, ply + 1);
             }
         }
 
-        repetition_index = old_rep_index;
-        take_back();
+        pos->repetition_index = old_rep_index;
+        unmake_move(pos, move, &undo);
 
         if (times_up)
             return 0;
@@ -948,19 +949,18 @@ int negamax(int alpha, int beta, int depth, int ply)
         if (score > best_so_far)
         {
             best_so_far = score;
-            best_move_found = move_list->moves[count];
+            best_move_found = move;
 
-            pv_table[ply][ply] = move_list->moves[count];
-            for (int next_ply = ply + 1; next_ply < pv_length[ply + 1]; next_ply++)
+            ctx->pv_table[ply][ply] = pack_move(move);
+            for (int next_ply = ply + 1; next_ply < ctx->pv_length[ply + 1]; next_ply++)
             {
-                pv_table[ply][next_ply] = pv_table[ply + 1][next_ply];
+                ctx->pv_table[ply][next_ply] = ctx->pv_table[ply + 1][next_ply];
             }
-            pv_length[ply] = pv_length[ply + 1];
+            ctx->pv_length[ply] = ctx->pv_length[ply + 1];
         }
 
         if (score >= beta)
         {
-            int move = move_list->moves[count];
             int piece = get_move_piece(move);
             int target = get_move_target(move);
             int from = get_move_source(move);
@@ -971,56 +971,48 @@ int negamax(int alpha, int beta, int depth, int ply)
 
             if (is_capture)
             {
-                int victim = P;
-                int start = (side == white) ? p : P;
-                int end = (side == white) ? k : K;
-                for (int p = start; p <= end; p++)
-                {
-                    if (get_bit(bitboards[p], target))
-                    {
-                        victim = p;
-                        break;
-                    }
-                }
-                capture_history[piece][target][victim % 6] += bonus * 4;
-                if (capture_history[piece][target][victim % 6] > history_max)
-                    capture_history[piece][target][victim % 6] = history_max;
+                int victim = pos->piece_on[target];
+                if (victim == no_piece)
+                    victim = P;
+                ctx->capture_history[piece][target][victim % 6] += bonus * 4;
+                if (ctx->capture_history[piece][target][victim % 6] > history_max)
+                    ctx->capture_history[piece][target][victim % 6] = history_max;
             }
             else
             {
-                if (move != killer_moves[0][ply])
+                if (pack_move(move) != ctx->killer_moves[0][ply])
                 {
-                    killer_moves[1][ply] = killer_moves[0][ply];
-                    killer_moves[0][ply] = move;
+                    ctx->killer_moves[1][ply] = ctx->killer_moves[0][ply];
+                    ctx->killer_moves[0][ply] = pack_move(move);
                 }
 
-                history_moves[piece][target] += bonus;
-                if (history_moves[piece][target] > history_max)
-                    history_moves[piece][target] = history_max;
+                ctx->history_moves[piece][target] += bonus;
+                if (ctx->history_moves[piece][target] > history_max)
+                    ctx->history_moves[piece][target] = history_max;
 
-                butterfly_history[side][from][target] += bonus;
-                if (butterfly_history[side][from][target] > history_max)
-                    butterfly_history[side][from][target] = history_max;
+                ctx->butterfly_history[pos->side][from][target] += bonus;
+                if (ctx->butterfly_history[pos->side][from][target] > history_max)
+                    ctx->butterfly_history[pos->side][from][target] = history_max;
 
-                if (ply > 0 && last_move_made[ply - 1])
+                if (ply > 0 && ctx->last_move_made[ply - 1])
                 {
-                    int lm = last_move_made[ply - 1];
-                    counter_moves[get_move_piece(lm)][get_move_target(lm)] = move;
+                    int lm = ctx->last_move_made[ply - 1];
+                    ctx->counter_moves[get_move_piece(lm)][get_move_target(lm)] = pack_move(move);
                 }
 
-                for (int i = 0; i < count; i++)
+                for (int i = 0; i < quiets_tried_count; i++)
                 {
-                    int bad_move = move_list->moves[i];
-                    if (!get_move_capture(bad_move) && bad_move != move)
+                    int bad_move = quiets_tried[i];
+                    if (bad_move != move)
                     {
-                        history_moves[get_move_piece(bad_move)][get_move_target(bad_move)] -= bonus / 2;
-                        if (history_moves[get_move_piece(bad_move)][get_move_target(bad_move)] < -history_max)
-                            history_moves[get_move_piece(bad_move)][get_move_target(bad_move)] = -history_max;
+                        ctx->history_moves[get_move_piece(bad_move)][get_move_target(bad_move)] -= bonus / 2;
+                        if (ctx->history_moves[get_move_piece(bad_move)][get_move_target(bad_move)] < -history_max)
+                            ctx->history_moves[get_move_piece(bad_move)][get_move_target(bad_move)] = -history_max;
                     }
                 }
             }
 
-            write_tt(depth, beta, HASH_BETA, move, ply);
+            write_tt(pos->hash_key, depth, beta, HASH_BETA, move, static_eval, ply);
             return beta;
         }
 
@@ -1028,12 +1020,12 @@ int negamax(int alpha, int beta, int depth, int ply)
         {
             alpha = score;
             if (ply == 0)
-                best_move = move_list->moves[count];
+                ctx->best_move = move;
         }
         // At ply 0, always ensure we have a move to play (first legal move found)
-        else if (ply == 0 && best_move == 0)
+        else if (ply == 0 && ctx->best_move == 0)
         {
-            best_move = move_list->moves[count];
+            ctx->best_move = move;
         }
     }
 
@@ -1048,63 +1040,200 @@ int negamax(int alpha, int beta, int depth, int ply)
 
     // Store in TT
     int flag = (alpha > old_alpha) ? HASH_EXACT : HASH_ALPHA;
-    write_tt(depth, alpha, flag, best_move_found, ply);
+    write_tt(pos->hash_key, depth, alpha, flag, best_move_found, static_eval, ply);
 
     return alpha;
 }
 
 // ============================================ \\
-//              PERFT (Performance Test)        \\
+//              ASPIRATION WINDOWS              \\
 // ============================================ \\
 
-void perft_driver(int depth)
+// Search the root at 'depth' with a window centred on the previous score,
+// widening exponentially on fail-low/fail-high.
+int aspiration_search(SearchContext *ctx, int depth, int prev_score)
 {
-    if (depth == 0)
+    if (depth < 5)
+        return negamax(ctx, -INF, INF, depth, 0);
+
+    int delta = 25;
+    int alpha = prev_score - delta;
+    int beta = prev_score + delta;
+    int score;
+
+    while (1)
     {
-        nodes++;
-        return;
+        if (alpha < -INF)
+            alpha = -INF;
+        if (beta > INF)
+            beta = INF;
+
+        score = negamax(ctx, alpha, beta, depth, 0);
+
+        if (times_up)
+            break;
+
+        if (score <= alpha)
+        {
+            // Fail low - widen alpha
+            beta = (alpha + beta) / 2;
+            alpha = score - delta;
+            delta += delta / 2 + 10;
+        }
+        else if (score >= beta)
+        {
+            // Fail high - widen beta
+            beta = score + delta;
+            delta += delta / 2 + 10;
+        }
+        else
+        {
+            // Score is within window
+            break;
+        }
+
+        if (delta > 1000)
+        {
+            // Window too large, do full search
+            score = negamax(ctx, -INF, INF, depth, 0);
+            break;
+        }
     }
+    return score;
+}
 
-    moves move_list[1];
-    generate_moves(move_list);
+// ============================================ \\
+//              LAZY SMP                        \\
+// ============================================ \\
 
-    for (int count = 0; count < move_list->count; count++)
+// Helper threads search the same root as the main thread, each in its own
+// SearchContext, sharing work only through the transposition table. The
+// main thread (context 0) alone reports and picks the move.
+
+static pthread_t helper_handles[MAX_THREADS];
+static int helpers_started = 0;
+static int helper_max_depth = 0;
+
+static void *helper_search(void *arg)
+{
+    SearchContext *ctx = (SearchContext *)arg;
+
+    // Odd helpers skip depth 1 so threads desynchronise quickly and fill
+    // the TT with different subtrees.
+    int prev_score = 0;
+    for (int depth = 1 + (ctx->thread_id & 1); depth <= helper_max_depth; depth++)
     {
-        copy_board();
+        int score = aspiration_search(ctx, depth, prev_score);
+        if (times_up)
+            break;
+        prev_score = score;
+    }
+    return NULL;
+}
 
-        if (!make_move(move_list->moves[count], all_moves))
-            continue;
+// Copy the main thread's root position into every helper context and start
+// the helpers. Heuristic tables persist per context between searches.
+void start_helper_threads(int max_depth)
+{
+    helper_max_depth = max_depth;
+
+    pthread_attr_t attr;
+    pthread_attr_init(&attr);
+    pthread_attr_setstacksize(&attr, 8 * 1024 * 1024);
 
-        perft_driver(depth - 1);
-        take_back();
+    helpers_started = 0;
+    for (int i = 1; i < num_threads; i++)
+    {
+        SearchContext *ctx = &search_contexts[i];
+        ctx->pos = search_contexts[0].pos;
+        ctx->thread_id = i;
+        ctx->nodes = 0;
+        ctx->best_move = 0;
+        memset(ctx->excluded_move, 0, sizeof(ctx->excluded_move));
+        if (pthread_create(&helper_handles[i], &attr, helper_search, ctx) != 0)
+            break;
+        helpers_started = i;
     }
+    pthread_attr_destroy(&attr);
+}
+
+// Signal helpers to stop (they poll times_up) and wait for them to finish.
+void stop_helper_threads()
+{
+    times_up = 1;
+    for (int i = 1; i <= helpers_started; i++)
+        pthread_join(helper_handles[i], NULL);
+    helpers_started = 0;
 }
 
-void perft_test(int depth)
+// Helpers are running, so the main thread is inside a search
+int search_threads_active()
 {
-    nodes = 0LL;
+    return helpers_started > 0;
+}
+
+// Nodes searched by all threads; helper counts are read racily, which is
+// fine for reporting.
+long long smp_total_nodes()
+{
+    long long total = search_contexts[0].nodes;
+    for (int i = 1; i <= helpers_started; i++)
+        total += search_contexts[i].nodes;
+    return total;
+}
+
+// ============================================ \\
+//              PERFT (Performance Test)        \\
+// ============================================ \\
+
+long long perft_driver(Position *pos, int depth)
+{
+    if (depth == 0)
+        return 1;
+
+    moves move_list[1];
+    generate_legal_moves(pos, move_list);
+
+    // Every generated move is legal, so the last ply is just counted
+    if (depth == 1)
+        return move_list->count;
+
+    long long count_nodes = 0;
+    for (int count = 0; count < move_list->count; count++)
+    {
+        int move = decode_with_position(pos, move_list->moves[count]);
+        undo_info undo;
+        make_move(pos, move, legal_move, &undo);
+        count_nodes += perft_driver(pos, depth - 1);
+        unmake_move(pos, move, &undo);
+    }
+    return count_nodes;
+}
+
+void perft_test(Position *pos, int depth)
+{
+    long long total = 0;
     printf("\n  Performance test\n\n");
 
     moves move_list[1];
-    generate_moves(move_list);
+    generate_legal_moves(pos, move_list);
 
     for (int count = 0; count < move_list->count; count++)
     {
-        copy_board();
+        int move = decode_with_position(pos, move_list->moves[count]);
+        undo_info undo;
 
-        if (!make_move(move_list->moves[count], all_moves))
-            continue;
+        make_move(pos, move, legal_move, &undo);
 
-        long cumulative_nodes = nodes;
-        perft_driver(depth - 1);
-        take_back();
+        long long move_nodes = perft_driver(pos, depth - 1);
+        unmake_move(pos, move, &undo);
 
-        long old_nodes = nodes - cumulative_nodes;
+        total += move_nodes;
         printf("  move: %d  ", count + 1);
-        print_move(move_list->moves[count]);
-        printf("  nodes: %ld\n", old_nodes);
+        print_move(move);
+        printf("  nodes: %lld\n", move_nodes);
     }
 
     printf("\n  Depth: %d\n", depth);
-    printf("  Nodes: %lld\n", nodes);
+    printf("  Nodes: %lld\n", total);
 }
@@ -7,6 +7,8 @@
 #define TYPES_H
 
 #include <stdio.h>
+#include <stdint.h>
+#include <stdatomic.h>
 #include <string.h>
 #include <stdlib.h>
 #include <sys/time.h>
@@ -20,9 +22,16 @@
 #else
 #include <unistd.h>
 #include <sys/select.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 #include <fcntl.h>
 #endif
 
+// BMI2 slider lookups ("make pext")
+#ifdef USE_PEXT
+#include <immintrin.h>
+#endif
+
 // ============================================ \\
 //              CORE DEFINITIONS                \\
 // ============================================ \\
@@ -36,6 +45,11 @@
 #define MAX_PLY 128
 #define MAX_GAME_MOVES 2048
 
+// Slider table sizes: sum of 2^relevant_bits over all squares
+#define BISHOP_TABLE_SIZE 5248
+#define ROOK_TABLE_SIZE 102400
+#define SLIDER_TABLE_SIZE (BISHOP_TABLE_SIZE + ROOK_TABLE_SIZE)
+
 // ============================================ \\
 //              ENUMERATIONS                    \\
 // ============================================ \\
@@ -132,7 +146,8 @@ enum
     b,
     r,
     q,
-    k
+    k,
+    no_piece
 };
 
 // Castling rights
@@ -148,7 +163,19 @@ enum
 enum
 {
     all_moves,
-    only_captures
+    only_captures,
+    legal_move // from the legal generator: no king-safety check needed
+};
+
+// Generator subsets: captures holds captures plus queen promotions, quiets
+// everything else (including underpromotions); quiet checks are the
+// non-promoting quiets that give check
+enum
+{
+    gen_all,
+    gen_captures,
+    gen_quiets,
+    gen_quiet_checks
 };
 
 // TT flags
@@ -160,23 +187,199 @@ enum
 //              DATA STRUCTURES                 \\
 // ============================================ \\
 
+// Packed move, see "Compact Move" below
+typedef uint16_t move16;
+
 // Move List Structure
 typedef struct
 {
-    int moves[256];
+    move16 moves[256];
     int count;
 } moves;
 
-// Transposition Table Entry
+// A decoded move with its ordering score, side by side so picking the
+// next move reads a single array
+typedef struct
+{
+    int move;
+    int score;
+} scored_move;
+
+// NNUE Inputs
+// Each side sees the board from its own side with its own pieces first,
+// mirrored so its king is on files a-d, and every input is tied to that
+// king's bucket: bucket * 768 + piece * 64 + square. Moving the king into
+// another bucket or across the centre line changes all of a side's inputs.
+#define NNUE_KING_BUCKETS 8
+#define NNUE_INPUT_SIZE (NNUE_KING_BUCKETS * 768) // king bucket * 12 pieces * 64 squares
+#define NNUE_HIDDEN1_SIZE 128                     // First hidden layer, per side
+
+extern const uint8_t nnue_king_buckets[64];
+
+// Bucket and mirroring of 'side's king on 'square'
+#define NNUE_KING_KEYS (NNUE_KING_BUCKETS * 2)
+#define nnue_king_key(side, square) \
+    (nnue_king_buckets[(square) ^ ((side) == white ? 0 : 56)] * 2 + (((square) & 7) >= 4))
+
+// NNUE Accumulator Stack
+// One entry per ply: make_move() pushes the board changes of its move
+// (piece * 64 + square), and evaluate_nnue() fills in each side's first
+// layer lazily from the nearest computed ancestor. The first layer is
+// quantized to int16 (see nnue.c). Search never goes deeper than MAX_PLY,
+// so the stack needs no bounds checks.
+#define NNUE_STACK_SIZE (MAX_PLY + 1)
+
+typedef struct
+{
+    _Alignas(64) int16_t hidden1[2][NNUE_HIDDEN1_SIZE]; // white's and black's view
+    int computed;   // bit per side: hidden1[side] is up to date
+    int refresh;    // bit per side: the move changed that side's king key
+    int num_added;
+    int num_removed;
+    int added[2];   // pieces the move into this entry put on a square
+    int removed[2]; // and took off
+} NNUEAccumulator;
+
+#define nnue_add_feature(acc, piece, square) ((acc)->added[(acc)->num_added++] = (piece) * 64 + (square))
+#define nnue_remove_feature(acc, piece, square) ((acc)->removed[(acc)->num_removed++] = (piece) * 64 + (square))
+
+// NNUE Refresh Cache
+// The last first layer built for each side and king key, with the board it
+// was built from. When a side's king key changes, its accumulator starts
+// from the cached one and only the pieces that differ are added and
+// removed, a handful in a king walk instead of all 32.
+typedef struct
+{
+    _Alignas(64) int16_t hidden1[NNUE_HIDDEN1_SIZE];
+    U64 bitboards[12];
+} NNUECacheEntry;
+
+// Empty the stack and the refresh cache; the position's accumulator is
+// rebuilt on the next eval
+#define nnue_reset(pos) ((pos)->nnue_top = 0, (pos)->nnue_stack[0].computed = 0, (pos)->nnue_cache_valid = 0)
+
+// Board Position
+// Everything needed to describe one game position, passed explicitly to
+// move generation, evaluation and search so several positions can live in
+// one process. The fields touched on every node (bitboards, occupancies,
+// hash_key) come first and fill the first two cache lines exactly; the
+// square-indexed mailbox (piece or no_piece) takes the third. The NNUE
+// accumulator stack and refresh cache come last and are only touched by
+// evaluate_nnue(); every search thread has its own Position, so they are
+// per thread.
 typedef struct
 {
-    U64 key;
-    int depth;
-    int flags;
-    int value;
+    _Alignas(64) U64 bitboards[12];
+    U64 occupancies[3];
+    U64 hash_key;
+    uint8_t piece_on[64];
+    int side;
+    int en_passant;
+    int castle;
+    int repetition_index;
+    U64 repetition_table[MAX_GAME_MOVES];
+    int nnue_top;
+    NNUEAccumulator nnue_stack[NNUE_STACK_SIZE];
+    uint32_t nnue_cache_valid; // bit per cache entry, side * NNUE_KING_KEYS + key
+    NNUECacheEntry nnue_cache[2][NNUE_KING_KEYS];
+} Position;
+
+// What make_move() cannot recompute when taking a move back; callers keep
+// one per ply on their own stack
+typedef struct
+{
+    int captured; // captured piece or no_piece
+    int castle;
+    int en_passant;
+    U64 hash_key;
+} undo_info;
+
+// Search Context
+// One per search thread: its own position plus all heuristic tables.
+typedef struct
+{
+    Position pos;
+    int thread_id;
     int best_move;
+    long long nodes;
+    int pv_length[MAX_PLY];
+    move16 pv_table[MAX_PLY][MAX_PLY];
+    move16 killer_moves[2][MAX_PLY];
+    int history_moves[12][64];
+    move16 counter_moves[12][64];
+    int butterfly_history[2][64][64];
+    int capture_history[12][64][6];
+    int last_move_made[MAX_PLY];
+    int static_eval_stack[MAX_PLY];
+    int excluded_move[MAX_PLY];
+} SearchContext;
+
+// Move picker stages, in the order moves are handed out
+enum
+{
+    STAGE_TT_MOVE,
+    STAGE_INIT_CAPTURES,
+    STAGE_GOOD_CAPTURES,
+    STAGE_KILLER_1,
+    STAGE_KILLER_2,
+    STAGE_COUNTER,
+    STAGE_INIT_QUIETS,
+    STAGE_QUIETS,
+    STAGE_BAD_CAPTURES,
+    STAGE_DONE
+};
+
+// Check and pin info for the side to move, worked out once per node so
+// gives_check() needs no make/unmake
+typedef struct
+{
+    U64 checkers;         // enemy pieces giving check
+    U64 pinned;           // own pieces pinned to our king
+    U64 discoverers;      // own pieces whose move may uncover a check
+    U64 check_squares[6]; // squares each piece type checks the enemy king from
+    int king_square;      // enemy king
+} CheckInfo;
+
+// Staged Move Picker
+// Hands out one move at a time: TT move, captures that pass SEE, killers
+// and counter move, quiets, then losing captures. Each list is generated
+// and scored only when its stage is reached.
+//
+// All stages share one scored array: captures fill it first, losing
+// captures are compacted to its front as they are found, and quiets are
+// appended after them.
+typedef struct
+{
+    int stage;
+    int index;
+    int end;
+    int bad_captures_end;
+    int tt_move;
+    int refutations[3]; // killer 1, killer 2, counter move
+    int captures_only;  // stop after the good captures (probcut)
+    moves generated[1]; // generator output, packed, before scoring
+    scored_move list[256];
+} MovePicker;
+
+// Transposition Table Entry (16 bytes), lockless: 'key' holds the full
+// hash XOR 'data', so an entry torn by concurrent writers fails
+// verification instead of returning another position's move or score.
+// data: move16 | value << 16 (17 bits) | eval << 33 (15 bits)
+//       | depth8 << 48 | gen_bound << 56
+typedef struct
+{
+    _Atomic U64 key;
+    _Atomic U64 data;
 } tt_entry;
 
+// Four entries share one 64-byte cache line
+#define TT_CLUSTER_SIZE 4
+
+typedef struct
+{
+    tt_entry entry[TT_CLUSTER_SIZE];
+} tt_cluster;
+
 // ============================================ \\
 //              BITWISE MACROS                  \\
 // ============================================ \\
@@ -220,28 +423,22 @@ typedef struct
 #define get_move_enpassant(move) (move & 0x400000)
 #define get_move_castling(move) (move & 0x800000)
 
-// ============================================ \\
-//           BOARD STATE MACROS                 \\
-// ============================================ \\
+/*
+  Compact Move (16 bits), the form moves are stored in (move lists, TT,
+  PV, killers, counter moves):
+  0000 0000 0011 1111    Source Square
+  0000 1111 1100 0000    Target Square
+  1111 0000 0000 0000    Promoted Piece (0 when none)
+
+  Source and target sit where they do in the full encoding, so
+  get_move_source() and get_move_target() read both. Piece and flags come
+  back from the board with decode_with_position().
+*/
+
+#define pack_move(move) ((move16)(((move) & 0xfff) | (((move) >> 4) & 0xf000)))
 
-#define copy_board()                             \
-    U64 bitboards_copy[12], occupancies_copy[3]; \
-    int side_copy, en_passant_copy, castle_copy; \
-    U64 hash_key_copy;                           \
-    memcpy(bitboards_copy, bitboards, 96);       \
-    memcpy(occupancies_copy, occupancies, 24);   \
-    side_copy = side;                            \
-    en_passant_copy = en_passant;                \
-    castle_copy = castle;                        \
-    hash_key_copy = hash_key;
-
-#define take_back()                            \
-    memcpy(bitboards, bitboards_copy, 96);     \
-    memcpy(occupancies, occupancies_copy, 24); \
-    side = side_copy;                          \
-    en_passant = en_passant_copy;              \
-    castle = castle_copy;                      \
-    hash_key = hash_key_copy;
+// Source, target and promotion only: enough to print or compare a move
+#define unpack_move(move) (((move) & 0xfff) | (((move) & 0xf000) << 4))
 
 // ============================================ \\
 //           GLOBAL EXTERN DECLARATIONS         \\
@@ -253,57 +450,76 @@ extern U64 knight_attacks[64];
 extern U64 king_attacks[64];
 extern U64 bishop_masks[64];
 extern U64 rook_masks[64];
-extern U64 bishop_attacks_table[64][512];
-extern U64 rook_attacks_table[64][4096];
-extern U64 bishop_magic_numbers[64];
-extern U64 rook_magic_numbers[64];
-
-// Board State
-extern U64 bitboards[12];
-extern U64 occupancies[3];
-extern int side;
-extern int en_passant;
-extern int castle;
+extern U64 slider_attacks_table[SLIDER_TABLE_SIZE];
+extern int bishop_offsets[64];
+extern int rook_offsets[64];
+extern const U64 bishop_magic_numbers[64];
+extern const U64 rook_magic_numbers[64];
+extern U64 between_squares[64][64];
+extern U64 line_through[64][64];
+extern int bishop_shifts[64];
+extern int rook_shifts[64];
 
 // Zobrist Hashing
 extern U64 piece_keys[12][64];
+// Fixed seed for the Zobrist keys; saved TT files record it
+#define ZOBRIST_SEED 1804289383
+
 extern U64 side_key;
 extern U64 castle_keys[16];
 extern U64 enpassant_keys[64];
-extern U64 hash_key;
-
-// Repetition Detection
-extern U64 repetition_table[MAX_GAME_MOVES];
-extern int repetition_index;
 
 // Transposition Table
-#define TT_DEFAULT_SIZE 0x400000
-extern tt_entry *transposition_table;
-extern U64 tt_num_entries;
+#define TT_DEFAULT_MB 16
+#define TT_MAX_MB 65536
+#define TT_NO_EVAL (-32768)
+extern tt_cluster *transposition_table;
+extern U64 tt_num_clusters;
 extern int tt_generation;
+
+// Multiply-high maps the whole key range onto [0, tt_num_clusters) without
+// a division
+#define tt_index(key) ((U64)(((unsigned __int128)(key) * tt_num_clusters) >> 64))
+#define prefetch_tt(key) __builtin_prefetch(&transposition_table[tt_index(key)])
 extern void init_tt(int mb);
 extern void resize_tt(int mb);
+extern void wait_tt_clear();
+extern int save_tt(const char *filename);
+extern int load_tt(const char *filename);
+
+// Compact moves
+extern int decode_with_position(const Position *pos, move16 packed);
+
+// Saved TT file: a page-sized header followed by the raw clusters, so the
+// table part can be memory-mapped straight from the file
+#define TT_FILE_MAGIC "FE64TT"
+#define TT_FILE_VERSION 1
+#define TT_FILE_HEADER_SIZE 4096
+
+typedef struct
+{
+    char magic[8];
+    uint32_t version;
+    uint32_t entry_size;
+    uint32_t cluster_size;
+    uint32_t generation;
+    uint64_t num_clusters;
+    uint64_t zobrist_seed;
+    uint64_t zobrist_check; // XOR of all Zobrist keys
+} tt_file_header;
 
 // Search State
-extern int best_move;
-extern long long nodes;
-extern int pv_length[MAX_PLY];
-extern int pv_table[MAX_PLY][MAX_PLY];
-extern int killer_moves[2][64];
-extern int history_moves[12][64];
-extern int counter_moves[12][64];
-extern int butterfly_history[2][64][64];
-extern int capture_history[12][64][6];
-extern int last_move_made[MAX_PLY];
 extern int lmr_table[MAX_PLY][64];
-extern int static_eval_stack[MAX_PLY];
-extern int excluded_move[MAX_PLY];
+
+// Lazy SMP
+#define MAX_THREADS 64
+extern SearchContext search_contexts[MAX_THREADS];
 
 // Timing
 extern long long start_time;
 extern long long stop_time;
 extern long long time_for_move;
-extern int times_up;
+extern volatile int times_up;
 extern volatile int quit_received;
 extern void restore_stdin_blocking();
 
@@ -318,11 +534,13 @@ extern int allow_ponder;
 
 // UCI Options
 extern int hash_size_mb;
+extern int num_threads;
 extern int multi_pv;
 extern int use_nnue_eval;
 extern int contempt;
 extern int use_book;
 extern int probcut_margin;
+extern int qsearch_checks;
 
 // Constants
 extern char *start_position;
@@ -352,24 +570,58 @@ extern int material_weights[12];
 //           INLINE UTILITY FUNCTIONS           \\
 // ============================================ \\
 
-// Count bits in a bitboard (population count)
+// Portable fallbacks: SWAR popcount and a De Bruijn bit scan. Always
+// compiled so the bit benchmark can compare them with the builtins.
+static inline int count_bits_portable(U64 bitboard)
+{
+    bitboard = bitboard - ((bitboard >> 1) & 0x5555555555555555ULL);
+    bitboard = (bitboard & 0x3333333333333333ULL) + ((bitboard >> 2) & 0x3333333333333333ULL);
+    bitboard = (bitboard + (bitboard >> 4)) & 0x0f0f0f0f0f0f0f0fULL;
+    return (int)((bitboard * 0x0101010101010101ULL) >> 56);
+}
+
+static const int debruijn_index64[64] = {
+    0, 1, 48, 2, 57, 49, 28, 3,
+    61, 58, 50, 42, 38, 29, 17, 4,
+    62, 55, 59, 36, 53, 51, 43, 22,
+    45, 39, 33, 30, 24, 18, 12, 5,
+    63, 47, 56, 27, 60, 41, 37, 16,
+    54, 35, 52, 21, 44, 32, 23, 11,
+    46, 26, 40, 15, 34, 20, 31, 10,
+    25, 14, 19, 9, 13, 8, 7, 6};
+
+static inline int get_ls1b_index_portable(U64 bitboard)
+{
+    if (bitboard)
+        return debruijn_index64[((bitboard & -bitboard) * 0x03f79d71b4cb0a89ULL) >> 58];
+    return -1;
+}
+
+// Count bits in a bitboard (population count). With -march=native or
+// -mpopcnt/-mbmi the builtins compile to POPCNT and TZCNT.
 static inline int count_bits(U64 bitboard)
 {
-    int count = 0;
-    while (bitboard)
-    {
-        count++;
-        bitboard &= bitboard - 1;
-    }
-    return count;
+#if defined(__GNUC__) || defined(__clang__)
+    return __builtin_popcountll(bitboard);
+#else
+    return count_bits_portable(bitboard);
+#endif
 }
 
 // Get index of least significant 1 bit
 static inline int get_ls1b_index(U64 bitboard)
 {
+#if defined(__GNUC__) || defined(__clang__)
     if (bitboard)
-        return count_bits((bitboard & -bitboard) - 1);
+        return __builtin_ctzll(bitboard);
     return -1;
+#else
+    return get_ls1b_index_portable(bitboard);
+#endif
 }
 
+// Clear the least significant 1 bit (BLSR); use instead of pop_bit() when
+// the square came from get_ls1b_index() on the same bitboard
+#define pop_ls1b(bitboard) ((bitboard) &= (bitboard) - 1)
+
 #endif // TYPES_H
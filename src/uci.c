@@ -10,20 +10,28 @@
 #include <unistd.h>
 
 // External function declarations
-extern void parse_position(char *command);
+extern void parse_position(Position *pos, char *command);
 extern void print_move(int move);
-extern int evaluate();
-extern int negamax(int alpha, int beta, int depth, int ply);
-extern int get_book_move();
+extern int evaluate(const Position *pos);
+extern int aspiration_search(SearchContext *ctx, int depth, int prev_score);
+extern void start_helper_threads(int max_depth);
+extern void stop_helper_threads();
+extern long long smp_total_nodes();
+extern void perft_test(Position *pos, int depth);
+extern int get_book_move(Position *pos);
 extern int load_opening_book(const char *filename);
 extern void free_opening_book();
 extern int load_nnue(const char *filename);
 extern int save_nnue(const char *filename);
-extern void init_nnue_random();
+extern int init_nnue_random();
 extern int nnue_weights_loaded();
 extern void clear_tt();
 extern void resize_tt(int mb);
 extern long long get_time_ms();
+extern long long tt_stress_test(int threads, long long iterations);
+extern void bench_bits(int rounds);
+extern void bench_sliders(int rounds);
+extern void bench_nnue(int rounds);
 
 // ============================================ \\
 //              UCI LOOP                        \\
@@ -36,6 +44,11 @@ void uci_loop()
 
     char input[2000];
 
+    // Game position set by "position"; each search starts from a copy of it
+    static Position root;
+    SearchContext *main_ctx = &search_contexts[0];
+    parse_position(&root, "position startpos");
+
     while (1)
     {
         memset(input, 0, sizeof(input));
@@ -68,6 +81,7 @@ void uci_loop()
             usleep(10000);
             pondering = 0;
             stop_pondering = 0;
+            wait_tt_clear(); // Don't report ready until a ucinewgame clear is done
             printf("readyok\n");
             fflush(stdout);
             continue;
@@ -131,6 +145,19 @@ void uci_loop()
                     }
                 }
             }
+            else if (strstr(input, "Threads"))
+            {
+                char *value = strstr(input, "value");
+                if (value)
+                {
+                    num_threads = atoi(value + 6);
+                    if (num_threads < 1)
+                        num_threads = 1;
+                    if (num_threads > MAX_THREADS)
+                        num_threads = MAX_THREADS;
+                    printf("info string Threads set to %d\n", num_threads);
+                }
+            }
             else if (strstr(input, "Hash"))
             {
                 char *value = strstr(input, "value");
@@ -139,8 +166,8 @@ void uci_loop()
                     hash_size_mb = atoi(value + 6);
                     if (hash_size_mb < 1)
                         hash_size_mb = 1;
-                    if (hash_size_mb > 4096)
-                        hash_size_mb = 4096;
+                    if (hash_size_mb > TT_MAX_MB)
+                        hash_size_mb = TT_MAX_MB;
                     resize_tt(hash_size_mb);
                     printf("info string Hash set to %d MB\n", hash_size_mb);
                 }
@@ -167,6 +194,11 @@ void uci_loop()
                     printf("info string MultiPV set to %d\n", multi_pv);
                 }
             }
+            else if (strstr(input, "QSearchChecks"))
+            {
+                qsearch_checks = (strstr(input, "true") != NULL);
+                printf("info string QSearchChecks %s\n", qsearch_checks ? "enabled" : "disabled");
+            }
             else if (strstr(input, "Ponder"))
             {
                 allow_ponder = (strstr(input, "true") != NULL);
@@ -176,18 +208,21 @@ void uci_loop()
         }
         else if (strncmp(input, "position", 8) == 0)
         {
-            parse_position(input);
+            parse_position(&root, input);
         }
         else if (strncmp(input, "ucinewgame", 10) == 0)
         {
-            parse_position("position startpos");
+            parse_position(&root, "position startpos");
             clear_tt();
             tt_generation = 0;
-            memset(killer_moves, 0, sizeof(killer_moves));
-            memset(history_moves, 0, sizeof(history_moves));
-            memset(counter_moves, 0, sizeof(counter_moves));
-            memset(butterfly_history, 0, sizeof(butterfly_history));
-            repetition_index = 0;
+            for (int i = 0; i < MAX_THREADS; i++)
+            {
+                SearchContext *ctx = &search_contexts[i];
+                memset(ctx->killer_moves, 0, sizeof(ctx->killer_moves));
+                memset(ctx->history_moves, 0, sizeof(ctx->history_moves));
+                memset(ctx->counter_moves, 0, sizeof(ctx->counter_moves));
+                memset(ctx->butterfly_history, 0, sizeof(ctx->butterfly_history));
+            }
         }
         else if (strncmp(input, "go", 2) == 0)
         {
@@ -196,13 +231,23 @@ void uci_loop()
             ponder_hit = 0;
             times_up = 0;
 
+            // "go perft N": count leaf nodes instead of searching
+            char *perft = strstr(input, "perft");
+            if (perft)
+            {
+                long long start = get_time_ms();
+                perft_test(&root, atoi(perft + 6));
+                printf("  Time: %lld ms\n", get_time_ms() - start);
+                continue;
+            }
+
             int is_ponder = allow_ponder && (strstr(input, "ponder") != NULL);
             pondering = is_ponder;
 
             // Check opening book first (not when pondering)
             if (use_book && !is_ponder)
             {
-                int book_move = get_book_move();
+                int book_move = get_book_move(&root);
                 if (book_move)
                 {
                     printf("info string Book move\n");
@@ -234,7 +279,7 @@ void uci_loop()
             if ((ptr = strstr(input, "movetime")))
                 movetime = atoi(ptr + 9);
 
-            if (side == white)
+            if (root.side == white)
             {
                 if ((ptr = strstr(input, "wtime")))
                     time = atoi(ptr + 6);
@@ -259,10 +304,10 @@ void uci_loop()
             else if (time != -1 && !infinite)
             {
                 // Game phase estimation
-                int phase = count_bits(bitboards[N] | bitboards[n]) +
-                            count_bits(bitboards[B] | bitboards[b]) +
-                            count_bits(bitboards[R] | bitboards[r]) * 2 +
-                            count_bits(bitboards[Q] | bitboards[q]) * 4;
+                int phase = count_bits(root.bitboards[N] | root.bitboards[n]) +
+                            count_bits(root.bitboards[B] | root.bitboards[b]) +
+                            count_bits(root.bitboards[R] | root.bitboards[r]) * 2 +
+                            count_bits(root.bitboards[Q] | root.bitboards[q]) * 4;
 
                 int expected_moves;
                 if (movestogo > 0)
@@ -337,29 +382,41 @@ void uci_loop()
                 search_depth = depth;
 
             // Setup search globals
+            wait_tt_clear();
             start_time = get_time_ms();
             times_up = 0;
-            nodes = 0;
-            best_move = 0; // Reset best move before search
-            memset(excluded_move, 0, sizeof(excluded_move));
+            tt_generation = (tt_generation + 1) & 63; // Ages entries from earlier searches
+            main_ctx->pos = root;
+            nnue_reset(&main_ctx->pos); // the net may have changed since the last search
+            main_ctx->thread_id = 0;
+            main_ctx->nodes = 0;
+            main_ctx->best_move = 0; // Reset best move before search
+            memset(main_ctx->excluded_move, 0, sizeof(main_ctx->excluded_move));
 
             // Age history tables
-            for (int i = 0; i < 12; i++)
+            for (int t = 0; t < num_threads; t++)
             {
-                for (int j = 0; j < 64; j++)
+                SearchContext *ctx = &search_contexts[t];
+                for (int i = 0; i < 12; i++)
                 {
-                    history_moves[i][j] /= 2;
-                    for (int k = 0; k < 6; k++)
-                        capture_history[i][j][k] /= 2;
+                    for (int j = 0; j < 64; j++)
+                    {
+                        ctx->history_moves[i][j] /= 2;
+                        for (int k = 0; k < 6; k++)
+                            ctx->capture_history[i][j][k] /= 2;
+                    }
                 }
+                for (int i = 0; i < 2; i++)
+                    for (int j = 0; j < 64; j++)
+                        for (int k = 0; k < 64; k++)
+                            ctx->butterfly_history[i][j][k] /= 2;
             }
-            for (int i = 0; i < 2; i++)
-                for (int j = 0; j < 64; j++)
-                    for (int k = 0; k < 64; k++)
-                        butterfly_history[i][j][k] /= 2;
 
             printf("info string Time allocated: %lld ms%s\n", time_for_move, is_ponder ? " (pondering until ponderhit/stop)" : "");
 
+            // Lazy SMP: helpers search the same root through the shared TT
+            start_helper_threads(search_depth);
+
             // Iterative deepening with aspiration windows
             int prev_score = 0;
             int score_stability = 0; // Tracks how stable the score is across iterations
@@ -370,58 +427,7 @@ void uci_loop()
                 if (times_up && current_depth > 1)
                     break;
 
-                int score;
-
-                if (current_depth >= 5)
-                {
-                    int delta = 25;
-                    int alpha = prev_score - delta;
-                    int beta = prev_score + delta;
-
-                    // Aspiration window loop with exponentially growing windows
-                    while (1)
-                    {
-                        if (alpha < -INF)
-                            alpha = -INF;
-                        if (beta > INF)
-                            beta = INF;
-
-                        score = negamax(alpha, beta, current_depth, 0);
-
-                        if (times_up)
-                            break;
-
-                        if (score <= alpha)
-                        {
-                            // Fail low - widen alpha
-                            beta = (alpha + beta) / 2;
-                            alpha = score - delta;
-                            delta += delta / 2 + 10;
-                        }
-                        else if (score >= beta)
-                        {
-                            // Fail high - widen beta
-                            beta = score + delta;
-                            delta += delta / 2 + 10;
-                        }
-                        else
-                        {
-                            // Score is within window
-                            break;
-                        }
-
-                        if (delta > 1000)
-                        {
-                            // Window too large, do full search
-                            score = negamax(-INF, INF, current_depth, 0);
-                            break;
-                        }
-                    }
-                }
-                else
-                {
-                    score = negamax(-INF, INF, current_depth, 0);
-                }
+                int score = aspiration_search(main_ctx, current_depth, prev_score);
 
                 if (times_up)
                     break;
@@ -440,7 +446,8 @@ void uci_loop()
                 long long elapsed = get_time_ms() - start_time;
                 if (elapsed < 1)
                     elapsed = 1;
-                long long nps = nodes * 1000 / elapsed;
+                long long total_nodes = smp_total_nodes();
+                long long nps = total_nodes * 1000 / elapsed;
 
                 printf("info depth %d score ", current_depth);
 
@@ -451,11 +458,11 @@ void uci_loop()
                 else
                     printf("cp %d", score);
 
-                printf(" nodes %lld nps %lld time %lld pv ", nodes, nps, elapsed);
+                printf(" nodes %lld nps %lld time %lld pv ", total_nodes, nps, elapsed);
 
-                for (int i = 0; i < pv_length[0]; i++)
+                for (int i = 0; i < main_ctx->pv_length[0]; i++)
                 {
-                    print_move(pv_table[0][i]);
+                    print_move(unpack_move(main_ctx->pv_table[0][i]));
                     printf(" ");
                 }
                 printf("\n");
@@ -484,21 +491,23 @@ void uci_loop()
                 }
             }
 
+            stop_helper_threads();
+
             // Output best move. Restore blocking stdin first because communicate()
             // temporarily enables non-blocking reads during search.
             restore_stdin_blocking();
             pondering = 0;
             printf("bestmove ");
-            if (best_move)
-                print_move(best_move);
+            if (main_ctx->best_move)
+                print_move(main_ctx->best_move);
             else
                 printf("0000");
 
-            if (allow_ponder && pv_length[0] >= 2 && pv_table[0][1])
+            if (allow_ponder && main_ctx->pv_length[0] >= 2 && main_ctx->pv_table[0][1])
             {
                 printf(" ponder ");
-                print_move(pv_table[0][1]);
-                ponder_move = pv_table[0][1];
+                print_move(unpack_move(main_ctx->pv_table[0][1]));
+                ponder_move = unpack_move(main_ctx->pv_table[0][1]);
             }
             printf("\n");
             fflush(stdout);
@@ -515,7 +524,8 @@ void uci_loop()
         {
             printf("id name Fe64 v4.4 - The Boa Constrictor\n");
             printf("id author Syed Masood\n");
-            printf("option name Hash type spin default 64 min 1 max 4096\n");
+            printf("option name Hash type spin default 64 min 1 max %d\n", TT_MAX_MB);
+            printf("option name Threads type spin default 1 min 1 max %d\n", MAX_THREADS);
             printf("option name Contempt type spin default 10 min -100 max 100\n");
             printf("option name MultiPV type spin default 1 min 1 max 10\n");
             printf("option name OwnBook type check default true\n");
@@ -523,6 +533,7 @@ void uci_loop()
             printf("option name UseNNUE type check default false\n");
             printf("option name NNUEFile type string default nnue.bin\n");
             printf("option name Ponder type check default true\n");
+            printf("option name QSearchChecks type check default false\n");
             printf("option name SyzygyPath type string default <empty>\n");
             printf("uciok\n");
         }
@@ -544,16 +555,54 @@ void uci_loop()
             char filename[256] = "nnue.bin";
             sscanf(input + 9, "%255s", filename);
             save_nnue(filename);
-            printf("info string NNUE saved to %s\n", filename);
         }
         else if (strncmp(input, "initnnue", 8) == 0)
         {
-            init_nnue_random();
-            printf("info string NNUE initialized with random weights\n");
+            if (init_nnue_random())
+                printf("info string NNUE initialized with random weights\n");
+        }
+        else if (strncmp(input, "savetthash", 10) == 0)
+        {
+            char filename[256] = "fe64.tt";
+            sscanf(input + 11, "%255s", filename);
+            save_tt(filename);
+        }
+        else if (strncmp(input, "loadtthash", 10) == 0)
+        {
+            char filename[256] = "fe64.tt";
+            sscanf(input + 11, "%255s", filename);
+            load_tt(filename);
+        }
+        else if (strncmp(input, "ttstress", 8) == 0)
+        {
+            // ttstress [threads] [operations per thread]
+            int threads = 8;
+            long long iterations = 2000000;
+            sscanf(input + 8, "%d %lld", &threads, &iterations);
+            tt_stress_test(threads, iterations);
+        }
+        else if (strncmp(input, "benchbits", 9) == 0)
+        {
+            int rounds = 2000;
+            sscanf(input + 9, "%d", &rounds);
+            bench_bits(rounds);
+        }
+        else if (strncmp(input, "benchsliders", 12) == 0)
+        {
+            int rounds = 20000;
+            sscanf(input + 12, "%d", &rounds);
+            bench_sliders(rounds);
+        }
+        else if (strncmp(input, "benchnnue", 9) == 0)
+        {
+            int rounds = 2000;
+            sscanf(input + 9, "%d", &rounds);
+            bench_nnue(rounds);
         }
         else if (strncmp(input, "eval", 4) == 0)
         {
-            printf("info string Static eval: %d cp\n", evaluate());
+            nnue_reset(&root);
+            printf("info string Static eval: %d cp\n", evaluate(&root));
         }
     }
 
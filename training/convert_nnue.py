@@ -0,0 +1,151 @@
+#!/usr/bin/env python3
+"""
+Fe64 NNUE Converter
+Turn a raw float net (nnue.bin as train_nnue.py and train_from_lichess.py
+write it) into the engine's quantized net file.
+
+Usage:
+    python convert_nnue.py nnue.bin -o fe64.nnue
+
+The net file is a 4096-byte header followed by the quantized weights in the
+engine's in-memory layout, so the engine maps it instead of reading it. The
+quantization here is bit-for-bit the one nnue_quantize() in src/nnue.c
+does; loading the float net in the engine and running "savennue" writes the
+same file.
+"""
+
+import argparse
+import math
+import os
+import struct
+import sys
+import zlib
+from array import array
+
+from nnue_arch import (INPUT_SIZE, HIDDEN1_SIZE, L2_INPUT_SIZE, HIDDEN2_SIZE,
+                       NUM_KING_BUCKETS, SCALE, KING_BUCKETS)
+
+# Net file format (must match src/nnue.c)
+FILE_MAGIC = b"FE64NNUE"
+FILE_VERSION = 1
+FILE_HEADER_SIZE = 4096
+HEADER_FORMAT = "<8sIIQIIII64sIIIII64s"  # packed little-endian NNUEFileHeader
+
+# Quantization (must match src/nnue.c)
+ACT_MAX = 127
+FT_SHIFT = 3
+FT_SCALE = ACT_MAX << FT_SHIFT
+MAX_WEIGHT_SHIFT = 12
+INT16_MAX = 32767
+
+
+def read_float_net(filename):
+    """The float arrays of a raw net, in file order."""
+    sizes = [INPUT_SIZE * HIDDEN1_SIZE, HIDDEN1_SIZE,
+             L2_INPUT_SIZE * HIDDEN2_SIZE, HIDDEN2_SIZE, HIDDEN2_SIZE, 1]
+    expected = 4 * sum(sizes)
+    actual = os.path.getsize(filename)
+    if actual != expected:
+        sys.exit(f"{filename} has {actual} bytes, a float net of this "
+                 f"architecture has {expected}")
+
+    arrays = []
+    with open(filename, 'rb') as f:
+        for size in sizes:
+            a = array('f')
+            a.fromfile(f, size)
+            if sys.byteorder != 'little':
+                a.byteswap()
+            arrays.append(a)
+    return arrays
+
+
+def quantize(values, scale, limit):
+    """roundf(x * scale) clamped to +-limit, with the product rounded to
+    float32 first as the engine computes it."""
+    products = array('f', [x * scale for x in values])
+    out = []
+    for q in products:
+        r = math.floor(abs(q) + 0.5)
+        r = min(r, limit)
+        out.append(int(-r if q < 0 else r))
+    return out
+
+
+def weight_shift(weights):
+    """Largest power of two (up to 2^MAX_WEIGHT_SHIFT) that keeps every
+    weight in +-127."""
+    top = max(abs(w) for w in weights)
+    shift = 0
+    while shift < MAX_WEIGHT_SHIFT and top * (1 << (shift + 1)) <= 127.0:
+        shift += 1
+    return shift
+
+
+def section(typecode, values):
+    """Little-endian bytes of one array, padded to a 64-byte boundary."""
+    a = array(typecode, values)
+    if sys.byteorder != 'little':
+        a.byteswap()
+    data = a.tobytes()
+    return data + bytes(-len(data) % 64)
+
+
+def quantize_net(arrays):
+    """(body bytes, hidden1 shift, hidden2 shift) of a float net."""
+    input_w, hidden1_b, hidden1_w, hidden2_b, hidden2_w, output_b = arrays
+
+    ft_weights = quantize(input_w, FT_SCALE, INT16_MAX)
+    ft_bias = [q + (1 << (FT_SHIFT - 1))
+               for q in quantize(hidden1_b, FT_SCALE, INT16_MAX - 4)]
+
+    shift1 = weight_shift(hidden1_w)
+    l2 = quantize(hidden1_w, 1 << shift1, 127)
+    # Transposed to one row per output, as the engine's kernels read it
+    l2_rows = [l2[i * HIDDEN2_SIZE + j]
+               for j in range(HIDDEN2_SIZE) for i in range(L2_INPUT_SIZE)]
+    l2_bias = [q + ((1 << (shift1 - 1)) if shift1 else 0)
+               for q in quantize(hidden2_b, ACT_MAX << shift1, 1 << 30)]
+
+    shift2 = weight_shift(hidden2_w)
+    out_w = quantize(hidden2_w, 1 << shift2, 127)
+    out_b = quantize(output_b, ACT_MAX << shift2, 1 << 30)
+
+    body = (section('h', ft_weights) + section('h', ft_bias) +
+            section('b', l2_rows) + section('i', l2_bias) +
+            section('i', out_w) + section('i', out_b))
+    return body, shift1, shift2
+
+
+def write_net(filename, body, shift1, shift2, description):
+    header = struct.pack(
+        HEADER_FORMAT, FILE_MAGIC, FILE_VERSION, zlib.crc32(body), len(body),
+        INPUT_SIZE, HIDDEN1_SIZE, HIDDEN2_SIZE, NUM_KING_BUCKETS,
+        bytes(KING_BUCKETS), FT_SCALE, ACT_MAX, shift1, shift2, SCALE,
+        description.encode()[:63])
+    with open(filename, 'wb') as f:
+        f.write(header + bytes(FILE_HEADER_SIZE - len(header)))
+        f.write(body)
+
+
+def main():
+    parser = argparse.ArgumentParser(
+        description='Convert a float NNUE to an Fe64 net file')
+    parser.add_argument('input', help='Raw float net (e.g. nnue.bin)')
+    parser.add_argument('--output', '-o',
+                        help='Net file to write (default: input with .nnue)')
+    parser.add_argument('--description', '-d',
+                        help='Description stored in the header')
+    args = parser.parse_args()
+
+    output = args.output or os.path.splitext(args.input)[0] + '.nnue'
+    description = args.description or \
+        f"converted from {os.path.basename(args.input)}"
+
+    body, shift1, shift2 = quantize_net(read_float_net(args.input))
+    write_net(output, body, shift1, shift2, description)
+    print(f"Wrote {output} ({len(body) >> 10} KB, shifts {shift1}/{shift2})")
+
+
+if __name__ == '__main__':
+    main()
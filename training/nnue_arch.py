@@ -0,0 +1,72 @@
+#!/usr/bin/env python3
+"""
+Fe64 NNUE Architecture
+Network sizes and the king-bucketed input features shared by the trainers.
+Everything here must match src/types.h and src/nnue.c.
+
+Each side sees the board from its own side with its own pieces first,
+mirrored so its king is on files a-d, and every input is tied to that
+king's bucket:
+
+    feature = bucket * 768 + piece * 64 + square
+
+Both sides' first layers share the input weights. The side to move's comes
+first in the second layer's inputs and the output is from its point of view.
+"""
+
+import numpy as np
+import chess
+
+# NNUE Architecture: (6144 -> 128) x 2 -> 32 -> 1
+NUM_KING_BUCKETS = 8
+INPUT_SIZE = NUM_KING_BUCKETS * 768  # king bucket * 12 pieces * 64 squares
+HIDDEN1_SIZE = 128                   # First hidden layer, per side
+L2_INPUT_SIZE = 2 * HIDDEN1_SIZE     # Both sides' first layers
+HIDDEN2_SIZE = 32                    # Second hidden layer
+OUTPUT_SIZE = 1                      # Single evaluation output
+SCALE = 400                          # Output scale factor
+
+# King bucket by engine square (a8 = 0, h1 = 63), from white's side
+KING_BUCKETS = [
+    7, 7, 7, 7, 7, 7, 7, 7,
+    7, 7, 7, 7, 7, 7, 7, 7,
+    7, 7, 7, 7, 7, 7, 7, 7,
+    7, 7, 7, 7, 7, 7, 7, 7,
+    6, 6, 6, 6, 6, 6, 6, 6,
+    6, 6, 6, 6, 6, 6, 6, 6,
+    4, 4, 5, 5, 5, 5, 4, 4,
+    0, 1, 2, 3, 3, 2, 1, 0,
+]
+
+PIECE_INDEX = {
+    chess.PAWN: 0, chess.KNIGHT: 1, chess.BISHOP: 2,
+    chess.ROOK: 3, chess.QUEEN: 4, chess.KING: 5
+}
+
+
+def engine_square(square):
+    """python-chess square (a1 = 0) to the engine's (a8 = 0)."""
+    return square ^ 56
+
+
+def side_features(board, color):
+    """Input features of every piece as seen by `color`."""
+    king = engine_square(board.king(color))
+    flip = 0 if color == chess.WHITE else 56
+    bucket = KING_BUCKETS[king ^ flip]
+    if (king & 7) >= 4:
+        flip ^= 7
+
+    features = []
+    for square, piece in board.piece_map().items():
+        relative = PIECE_INDEX[piece.piece_type] + \
+            (0 if piece.color == color else 6)
+        features.append(bucket * 768 + relative * 64 +
+                        (engine_square(square) ^ flip))
+    return np.array(features, dtype=np.int64)
+
+
+def board_features(board):
+    """(side to move, other side) feature index arrays for `board`."""
+    return (side_features(board, board.turn),
+            side_features(board, not board.turn))
@@ -30,12 +30,14 @@ except ImportError as e:
     print("Install with: pip install requests numpy chess")
     sys.exit(1)
 
-# NNUE Architecture (must match bbc.c)
-NNUE_INPUT_SIZE = 768      # 12 pieces * 64 squares
-NNUE_HIDDEN1_SIZE = 256    # First hidden layer
-NNUE_HIDDEN2_SIZE = 32     # Second hidden layer
-NNUE_OUTPUT_SIZE = 1       # Single evaluation output
-NNUE_SCALE = 400           # Scale factor
+# NNUE Architecture (shared with train_nnue.py, must match the engine)
+from nnue_arch import (INPUT_SIZE as NNUE_INPUT_SIZE,
+                       HIDDEN1_SIZE as NNUE_HIDDEN1_SIZE,
+                       L2_INPUT_SIZE as NNUE_L2_INPUT_SIZE,
+                       HIDDEN2_SIZE as NNUE_HIDDEN2_SIZE,
+                       OUTPUT_SIZE as NNUE_OUTPUT_SIZE,
+                       SCALE as NNUE_SCALE,
+                       board_features)
 
 
 class NNUETrainer:
@@ -46,8 +48,8 @@ class NNUETrainer:
         self.input_weights = np.random.randn(NNUE_INPUT_SIZE, NNUE_HIDDEN1_SIZE).astype(
             np.float32) * np.sqrt(2.0 / NNUE_INPUT_SIZE)
         self.hidden1_bias = np.zeros(NNUE_HIDDEN1_SIZE, dtype=np.float32)
-        self.hidden1_weights = np.random.randn(NNUE_HIDDEN1_SIZE, NNUE_HIDDEN2_SIZE).astype(
-            np.float32) * np.sqrt(2.0 / NNUE_HIDDEN1_SIZE)
+        self.hidden1_weights = np.random.randn(NNUE_L2_INPUT_SIZE, NNUE_HIDDEN2_SIZE).astype(
+            np.float32) * np.sqrt(2.0 / NNUE_L2_INPUT_SIZE)
         self.hidden2_bias = np.zeros(NNUE_HIDDEN2_SIZE, dtype=np.float32)
         self.hidden2_weights = np.random.randn(NNUE_HIDDEN2_SIZE).astype(
             np.float32) * np.sqrt(2.0 / NNUE_HIDDEN2_SIZE)
@@ -61,7 +63,7 @@ class NNUETrainer:
             self.hidden1_bias = np.frombuffer(
                 f.read(NNUE_HIDDEN1_SIZE * 4), dtype=np.float32)
             self.hidden1_weights = np.frombuffer(f.read(
-                NNUE_HIDDEN1_SIZE * NNUE_HIDDEN2_SIZE * 4), dtype=np.float32).reshape(NNUE_HIDDEN1_SIZE, NNUE_HIDDEN2_SIZE)
+                NNUE_L2_INPUT_SIZE * NNUE_HIDDEN2_SIZE * 4), dtype=np.float32).reshape(NNUE_L2_INPUT_SIZE, NNUE_HIDDEN2_SIZE)
             self.hidden2_bias = np.frombuffer(
                 f.read(NNUE_HIDDEN2_SIZE * 4), dtype=np.float32)
             self.hidden2_weights = np.frombuffer(
@@ -82,7 +84,7 @@ class NNUETrainer:
 
         # Verify file size
         expected_size = (NNUE_INPUT_SIZE * NNUE_HIDDEN1_SIZE + NNUE_HIDDEN1_SIZE +
-                         NNUE_HIDDEN1_SIZE * NNUE_HIDDEN2_SIZE + NNUE_HIDDEN2_SIZE +
+                         NNUE_L2_INPUT_SIZE * NNUE_HIDDEN2_SIZE + NNUE_HIDDEN2_SIZE +
                          NNUE_HIDDEN2_SIZE + 1) * 4
         actual_size = os.path.getsize(filename)
         if actual_size != expected_size:
@@ -102,30 +104,21 @@ class NNUETrainer:
         return ((x > 0) & (x < 1)).astype(np.float32)
 
     def board_to_input(self, board):
-        """Convert chess.Board to NNUE input vector"""
-        input_vec = np.zeros(NNUE_INPUT_SIZE, dtype=np.float32)
-
-        piece_map = {
-            chess.PAWN: 0, chess.KNIGHT: 1, chess.BISHOP: 2,
-            chess.ROOK: 3, chess.QUEEN: 4, chess.KING: 5
-        }
-
-        for square in chess.SQUARES:
-            piece = board.piece_at(square)
-            if piece:
-                piece_idx = piece_map[piece.piece_type]
-                if piece.color == chess.BLACK:
-                    piece_idx += 6
-                idx = piece_idx * 64 + square
-                input_vec[idx] = 1.0
-
-        return input_vec
-
-    def forward(self, input_vec):
-        """Forward pass through the network"""
+        """Convert chess.Board to NNUE inputs: the active feature indices of
+        the side to move and of the other side"""
+        return board_features(board)
+
+    def layer1(self, features):
+        """Both sides' first layers, side to move first (before CReLU)"""
+        stm, nstm = features
+        return np.concatenate([
+            self.hidden1_bias + self.input_weights[stm].sum(axis=0),
+            self.hidden1_bias + self.input_weights[nstm].sum(axis=0)])
+
+    def forward(self, features):
+        """Forward pass through the network, from the side to move's view"""
         # Layer 1
-        hidden1 = self.crelu(
-            np.dot(input_vec, self.input_weights) + self.hidden1_bias)
+        hidden1 = self.crelu(self.layer1(features))
         # Layer 2
         hidden2 = self.crelu(
             np.dot(hidden1, self.hidden1_weights) + self.hidden2_bias)
@@ -147,9 +140,9 @@ class NNUETrainer:
 
         batch_size = len(positions)
 
-        for input_vec, target in zip(positions, targets):
+        for features, target in zip(positions, targets):
             # Forward pass
-            z1 = np.dot(input_vec, self.input_weights) + self.hidden1_bias
+            z1 = self.layer1(features)
             hidden1 = self.crelu(z1)
             z2 = np.dot(hidden1, self.hidden1_weights) + self.hidden2_bias
             hidden2 = self.crelu(z2)
@@ -171,10 +164,14 @@ class NNUETrainer:
             grad_hidden2_bias += d_hidden2
             grad_hidden1_weights += np.outer(hidden1, d_hidden2)
 
+            # Both sides' first layers share the input weights
             d_hidden1 = np.dot(
                 d_hidden2, self.hidden1_weights.T) * self.crelu_derivative(z1)
-            grad_hidden1_bias += d_hidden1
-            grad_input_weights += np.outer(input_vec, d_hidden1)
+            d_stm = d_hidden1[:NNUE_HIDDEN1_SIZE]
+            d_nstm = d_hidden1[NNUE_HIDDEN1_SIZE:]
+            grad_hidden1_bias += d_stm + d_nstm
+            np.add.at(grad_input_weights, features[0], d_stm)
+            np.add.at(grad_input_weights, features[1], d_nstm)
 
         # Update weights (ensure float32 after operations)
         self.input_weights = (
@@ -375,7 +372,7 @@ def main():
 
     for pos in all_positions:
         board = pos['board']
-        input_vec = trainer.board_to_input(board)
+        features = trainer.board_to_input(board)
         material_eval = simple_material_eval(board)
         target = calculate_target_eval(pos, material_eval)
 
@@ -383,7 +380,7 @@ def main():
         if board.turn == chess.BLACK:
             target = -target
 
-        training_data.append((input_vec, target))
+        training_data.append((features, target))
 
     # Train
     print(f"\nTraining for {args.epochs} epochs...")
@@ -16,12 +16,9 @@ import math
 import numpy as np
 from collections import defaultdict
 
-# NNUE Architecture
-INPUT_SIZE = 768   # 12 pieces * 64 squares
-HIDDEN1_SIZE = 256  # First hidden layer
-HIDDEN2_SIZE = 32  # Second hidden layer
-OUTPUT_SIZE = 1    # Single evaluation output
-SCALE = 400        # Output scale factor
+# NNUE Architecture (shared with train_from_lichess.py, must match the engine)
+from nnue_arch import (INPUT_SIZE, HIDDEN1_SIZE, L2_INPUT_SIZE, HIDDEN2_SIZE,
+                       OUTPUT_SIZE, SCALE, board_features)
 
 
 class NNUENetwork:
@@ -32,8 +29,8 @@ class NNUENetwork:
         self.input_weights = (np.random.randn(INPUT_SIZE, HIDDEN1_SIZE) *
                               np.sqrt(2.0 / INPUT_SIZE)).astype(np.float32)
         self.hidden1_bias = np.zeros(HIDDEN1_SIZE, dtype=np.float32)
-        self.hidden1_weights = (np.random.randn(HIDDEN1_SIZE, HIDDEN2_SIZE) *
-                                np.sqrt(2.0 / HIDDEN1_SIZE)).astype(np.float32)
+        self.hidden1_weights = (np.random.randn(L2_INPUT_SIZE, HIDDEN2_SIZE) *
+                                np.sqrt(2.0 / L2_INPUT_SIZE)).astype(np.float32)
         self.hidden2_bias = np.zeros(HIDDEN2_SIZE, dtype=np.float32)
         self.hidden2_weights = (np.random.randn(HIDDEN2_SIZE) *
                                 np.sqrt(2.0 / HIDDEN2_SIZE)).astype(np.float32)
@@ -47,7 +44,7 @@ class NNUENetwork:
             self.hidden1_bias = np.frombuffer(
                 f.read(HIDDEN1_SIZE * 4), dtype=np.float32)
             self.hidden1_weights = np.frombuffer(f.read(
-                HIDDEN1_SIZE * HIDDEN2_SIZE * 4), dtype=np.float32).reshape(HIDDEN1_SIZE, HIDDEN2_SIZE)
+                L2_INPUT_SIZE * HIDDEN2_SIZE * 4), dtype=np.float32).reshape(L2_INPUT_SIZE, HIDDEN2_SIZE)
             self.hidden2_bias = np.frombuffer(
                 f.read(HIDDEN2_SIZE * 4), dtype=np.float32)
             self.hidden2_weights = np.frombuffer(
@@ -67,62 +64,34 @@ class NNUENetwork:
         print(f"Saved NNUE to {filename}")
 
     def board_to_features(self, board):
-        """Convert a chess board to NNUE input features."""
-        features = np.zeros(INPUT_SIZE, dtype=np.float32)
-
-        piece_map = {
-            chess.PAWN: 0, chess.KNIGHT: 1, chess.BISHOP: 2,
-            chess.ROOK: 3, chess.QUEEN: 4, chess.KING: 5
-        }
-
-        for square in chess.SQUARES:
-            piece = board.piece_at(square)
-            if piece:
-                piece_idx = piece_map[piece.piece_type]
-                if piece.color == chess.BLACK:
-                    piece_idx += 6
-                # Convert to our engine's square mapping (a8=0, h1=63)
-                rank = chess.square_rank(square)
-                file = chess.square_file(square)
-                our_sq = (7 - rank) * 8 + file
-                feature_idx = piece_idx * 64 + our_sq
-                features[feature_idx] = 1.0
-
-        return features
+        """Convert a chess board to NNUE input features: the active
+        feature indices of the side to move and of the other side."""
+        return board_features(board)
 
     def forward(self, features):
-        """Forward pass through the network."""
-        # Layer 1
-        hidden1 = self.hidden1_bias.copy()
-        active_indices = np.where(features > 0)[0]
-        for idx in active_indices:
-            hidden1 += self.input_weights[idx]
-        hidden1 = np.clip(hidden1, 0, 1)  # CReLU
-
-        # Layer 2
-        hidden2 = self.hidden2_bias + hidden1 @ self.hidden1_weights
-        hidden2 = np.clip(hidden2, 0, 1)  # CReLU
-
-        # Output
-        output = self.output_bias + hidden2 @ self.hidden2_weights
+        """Forward pass through the network, from the side to move's view."""
+        output, _ = self.forward_with_cache(features)
         return output
 
     def forward_with_cache(self, features):
         """Forward pass with intermediate values cached for backprop."""
-        hidden1_pre = self.hidden1_bias.copy()
-        active_indices = np.where(features > 0)[0]
-        for idx in active_indices:
-            hidden1_pre += self.input_weights[idx]
-        hidden1 = np.clip(hidden1_pre, 0, 1)
+        stm, nstm = features
+
+        # Layer 1: both sides share the input weights, side to move first
+        hidden1_pre = np.concatenate([
+            self.hidden1_bias + self.input_weights[stm].sum(axis=0),
+            self.hidden1_bias + self.input_weights[nstm].sum(axis=0)])
+        hidden1 = np.clip(hidden1_pre, 0, 1)  # CReLU
 
+        # Layer 2
         hidden2_pre = self.hidden2_bias + hidden1 @ self.hidden1_weights
-        hidden2 = np.clip(hidden2_pre, 0, 1)
+        hidden2 = np.clip(hidden2_pre, 0, 1)  # CReLU
 
+        # Output
         output = self.output_bias + hidden2 @ self.hidden2_weights
 
         return output, {
             'features': features,
-            'active_indices': active_indices,
             'hidden1_pre': hidden1_pre,
             'hidden1': hidden1,
             'hidden2_pre': hidden2_pre,
@@ -152,18 +121,20 @@ class NNUENetwork:
         mask1 = ((cache['hidden1_pre'] > 0) &
                  (cache['hidden1_pre'] < 1)).astype(np.float32)
         d_hidden1_pre = d_hidden1 * mask1
+        d_stm = d_hidden1_pre[:HIDDEN1_SIZE]
+        d_nstm = d_hidden1_pre[HIDDEN1_SIZE:]
 
         # Update weights with gradient descent
         self.output_bias -= lr * error
         self.hidden2_weights -= lr * d_hidden2_weights
         self.hidden2_bias -= lr * d_hidden2_pre
         self.hidden1_weights -= lr * np.outer(cache['hidden1'], d_hidden2_pre)
-        self.hidden1_bias -= lr * d_hidden1_pre
+        self.hidden1_bias -= lr * (d_stm + d_nstm)
 
-        # Only update active input weights (vectorized)
-        if len(cache['active_indices']) > 0:
-            self.input_weights[cache['active_indices']
-                               ] -= lr * d_hidden1_pre[np.newaxis, :]
+        # Only update active input weights; a row can be active for both sides
+        stm, nstm = cache['features']
+        np.subtract.at(self.input_weights, stm, lr * d_stm)
+        np.subtract.at(self.input_weights, nstm, lr * d_nstm)
 
         return error ** 2  # Return loss
 
@@ -314,7 +285,7 @@ def train_nnue(pgn_files, output_file, epochs=50, lr=0.001, batch_size=64, stock
 
     print(f"\nTotal training positions: {len(all_positions)}")
     print(
-        f"Network architecture: {INPUT_SIZE} -> {HIDDEN1_SIZE} -> {HIDDEN2_SIZE} -> {OUTPUT_SIZE}")
+        f"Network architecture: ({INPUT_SIZE} -> {HIDDEN1_SIZE}) x 2 -> {HIDDEN2_SIZE} -> {OUTPUT_SIZE}")
     print(f"Learning rate: {lr}")
     print(f"Epochs: {epochs}")
     print()
@@ -330,6 +301,10 @@ def train_nnue(pgn_files, output_file, epochs=50, lr=0.001, batch_size=64, stock
             batch_loss = 0.0
 
             for board, target in batch:
+                # Targets are white's winning chances; the net scores for
+                # the side to move
+                if board.turn == chess.BLACK:
+                    target = 1.0 - target
                 features = net.board_to_features(board)
                 output, cache = net.forward_with_cache(features)
 